@@ -3,6 +3,8 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
+#include <vector>
 
 using RenderObjectPtr = std::shared_ptr<class RenderObject>;
 
@@ -14,13 +16,36 @@ class vec3;
 
 using Tick = std::function<void(float)>;
 
+// A tick with the animated values it writes and reads, so a view only runs
+// the ones the shown animation depends on.
+struct Ticker
+{
+  Tick tick;
+  std::vector<const float *> writes;
+  std::vector<const float *> reads;
+  // > 0 if the written values repeat every period seconds without jumps,
+  // < 0 if they only follow the reads, 0 if neither is known
+  float period{0.0f};
+
+  // set by lfo, center + amp * sin(2 pi frequency t) into value, for
+  // evaluating many of them at once
+  struct Wave
+  {
+    float center;
+    float amp;
+    float frequency;
+    float *value;
+  };
+  std::optional<Wave> wave;
+};
+
 class SceneHandler
 {
 public:
   virtual ~SceneHandler() = default;
 
   virtual void add_animation(const QString &, float l, const slm::vec3 &, RenderObjectPtr) = 0;
-  virtual void on_tick(const Tick &) = 0;
+  virtual void on_tick(const Ticker &) = 0;
 };
 
 #endif // SCENEHANDLER_H
@@ -0,0 +1,49 @@
+#include "bakedanimation.h"
+
+#include <algorithm>
+#include <cmath>
+
+void BakedAnimation::clear()
+{
+  m_values.clear();
+  m_samples.clear();
+  m_frames = 0;
+  m_length = 0.0f;
+}
+
+void BakedAnimation::bake(const std::vector<float *> &values, float length, float rate, int limit,
+                          const std::function<void(float)> &tick)
+{
+  clear();
+  const auto steps = int(std::ceil(length * rate));
+  if (values.empty() || steps < 1 || double(steps + 1) * double(values.size()) > double(limit))
+    return;
+
+  // one row per sample, the last one at length to interpolate into
+  m_values = values;
+  m_samples.reserve(size_t(steps + 1) * values.size());
+  for (int i = 0; i <= steps; ++i)
+  {
+    tick(length * float(i) / float(steps));
+    for (const auto *v : m_values)
+      m_samples.push_back(*v);
+  }
+  m_frames = steps + 1;
+  m_length = length;
+}
+
+void BakedAnimation::apply(float t) const
+{
+  if (empty())
+    return;
+
+  const auto u = t / m_length;
+  const auto x = (u - std::floor(u)) * float(m_frames - 1);
+  const auto i = std::min(int(x), m_frames - 2);
+  const auto f = x - float(i);
+  const auto n = m_values.size();
+  const auto *a = m_samples.data() + size_t(i) * n;
+  const auto *b = a + n;
+  for (size_t j = 0; j < n; ++j)
+    *m_values[j] = a[j] + (b[j] - a[j]) * f;
+}
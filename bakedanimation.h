@@ -0,0 +1,31 @@
+#ifndef BAKEDANIMATION_H
+#define BAKEDANIMATION_H
+
+#include <functional>
+#include <vector>
+
+// Animated values an animation draws, sampled over its length. Playback
+// interpolates between the samples instead of running the tickers, so only
+// values repeating every length without jumps should be baked.
+class BakedAnimation
+{
+public:
+  void clear();
+  bool empty() const { return m_frames == 0; }
+
+  // calls tick at rate samples per second over length and records values,
+  // stays empty when that would take more than limit floats
+  void bake(const std::vector<float *> &values, float length, float rate, int limit,
+            const std::function<void(float)> &tick);
+
+  // sets the values for t, repeating every length
+  void apply(float t) const;
+
+private:
+  std::vector<float *> m_values;
+  std::vector<float> m_samples;
+  int m_frames{0};
+  float m_length{0.0f};
+};
+
+#endif // BAKEDANIMATION_H
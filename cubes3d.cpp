@@ -1,5 +1,6 @@
 #include "cubes3d.h"
 
+#include "scene.h"
 #include "ui_cubes3d.h"
 
 #include <QAbstractItemView>
@@ -18,8 +19,10 @@
 #include <QSettings>
 #include <QShortcut>
 #include <QStatusBar>
+#include <QThread>
 #include <QTimer>
 #include <memory>
+#include <utility>
 
 class CompleterEdit : public QLineEdit
 {
@@ -47,7 +50,7 @@ Cubes3D::Cubes3D(QWidget *parent)
 {
   ui->setupUi(this);
 
-  m_feWrap = std::make_unique<FeWrap>(*ui->view3d);
+  m_feWrap = std::make_unique<FeWrap>();
 
   m_lineColumn = new QLabel{QString("0,0"), this};
   m_lineColumn->setFont(ui->teFeIn->font());
@@ -101,13 +104,52 @@ Cubes3D::Cubes3D(QWidget *parent)
 
 Cubes3D::~Cubes3D()
 {
+  if (m_evalThread)
+  {
+    // a cancel before the eval started is dropped
+    do
+      m_feWrap->cancel();
+    while (!m_evalThread->wait(50));
+  }
+  // the display objects fe still holds are released while the view lives
+  m_feWrap.reset();
   delete ui;
 }
 
 void Cubes3D::closeEvent(QCloseEvent *e)
 {
-  if (!on_actionsave_triggered())
-    return;
+  if (m_evalThread)
+  {
+    // a cancel before the eval started is dropped
+    do
+      m_feWrap->cancel();
+    while (!m_evalThread->wait(50));
+  }
+
+  // evaluated in place without a time limit, the files are only written if
+  // they still evaluate
+  m_feWrap->setCodeOf(m_editFile, ui->teFeIn->toPlainText());
+  bool evaluates = true;
+  try
+  {
+    Scene scene;
+    m_feWrap->eval(scene);
+  }
+  catch (const std::exception &x)
+  {
+    ui->teFeOut->clear();
+    ui->teFeOut->setTextColor(Qt::red);
+    ui->teFeOut->append(QString("ERROR: ") + x.what());
+    if (QMessageBox::Yes != QMessageBox::question(this, QApplication::applicationName(),
+                                                  "The scene does not evaluate!<br/>Close without saving?"))
+    {
+      e->ignore();
+      return;
+    }
+    evaluates = false;
+  }
+  if (evaluates)
+    saveFiles();
 
   QSettings s;
   s.setValue("Main/geomtry", saveGeometry());
@@ -130,23 +172,19 @@ void Cubes3D::timerEvent(QTimerEvent *t)
 
 void Cubes3D::open_file(const QString &f)
 {
-  QApplication::setOverrideCursor(Qt::WaitCursor);
-
   m_feFile = f;
 
   setEditFile(m_feWrap->newSession(m_feFile));
-  eval_main();
-
-  ui->teFeIn->document()->setModified(false);
-  setEditFile(m_editFile);
+  eval_main([this] {
+    ui->teFeIn->document()->setModified(false);
+    setEditFile(m_editFile);
+  });
 
   QSettings s;
   auto recent = s.value("Main/RecentFiles").toStringList();
   recent.removeAll(f);
   recent.prepend(f);
   s.setValue("Main/RecentFiles", recent);
-
-  QApplication::restoreOverrideCursor();
 }
 
 void Cubes3D::on_actionnew_triggered()
@@ -181,21 +219,20 @@ void Cubes3D::on_actionopen_triggered()
   open_file(f);
 }
 
-bool Cubes3D::on_actionsave_triggered()
+void Cubes3D::on_actionsave_triggered()
 {
-  QApplication::setOverrideCursor(Qt::WaitCursor);
-  const auto guard = std::unique_ptr<Cubes3D, std::function<void(Cubes3D *)>>(
-      this, [](Cubes3D *) { QApplication::restoreOverrideCursor(); });
-
+  // the running eval is outdated by the saved text
+  if (m_evalThread)
+    m_feWrap->cancel();
   m_feWrap->setCodeOf(m_editFile, ui->teFeIn->toPlainText());
-  if (eval_main())
-  {
-    m_feWrap->saveFiles();
-    ui->teFeIn->document()->setModified(false);
-    setEditFile(m_editFile);
-    return true;
-  }
-  return false;
+  eval_main([this] { saveFiles(); });
+}
+
+void Cubes3D::saveFiles()
+{
+  m_feWrap->saveFiles();
+  ui->teFeIn->document()->setModified(false);
+  setEditFile(m_editFile);
 }
 
 void Cubes3D::on_actionquit_triggered()
@@ -525,24 +562,73 @@ void Cubes3D::addAction(const QString &name, const std::function<void()> &t)
   addAction(name, {}, t);
 }
 
-bool Cubes3D::eval_main()
+void Cubes3D::eval_main(const std::function<void()> &onSuccess)
 {
-  ui->teFeOut->clear();
-  ui->view3d->clear_scene();
-  try
+  // One eval at a time, a request meanwhile cancels it and runs after it. The
+  // shown scene keeps animating until a successful eval replaces it.
+  if (m_evalThread)
   {
-    ui->teFeOut->setTextColor(Qt::black);
-    ui->teFeOut->append(m_feWrap->eval());
+    m_feWrap->cancel();
+    m_evalPending = true;
+    m_pendingSuccess = onSuccess;
+    return;
   }
-  catch (const std::exception &e)
+
+  struct Evaluation
+  {
+    Scene scene;
+    QString text;
+    bool ok{false};
+  };
+  auto e = std::make_shared<Evaluation>();
+  const auto revision = ui->teFeIn->document()->revision();
+  m_evalThread = QThread::create([this, e] {
+    try
+    {
+      e->text = m_feWrap->eval(e->scene);
+      e->ok = true;
+    }
+    catch (const std::exception &x)
+    {
+      e->text = x.what();
+    }
+  });
+  connect(m_evalThread, &QThread::finished, this, [this, e, revision, onSuccess] {
+    m_evalThread->deleteLater();
+    m_evalThread = nullptr;
+
+    if (showEvaluation(e->ok, e->text, std::move(e->scene), revision) && onSuccess)
+      onSuccess();
+
+    if (m_evalPending)
+    {
+      m_evalPending = false;
+      eval_main(std::exchange(m_pendingSuccess, {}));
+    }
+  });
+  m_evalThread->start();
+}
+
+bool Cubes3D::showEvaluation(bool ok, const QString &text, Scene &&scene, int revision)
+{
+  ui->teFeOut->clear();
+  if (!ok)
   {
     ui->teFeOut->setTextColor(Qt::red);
-    ui->teFeOut->append(QString("ERROR: ") + e.what());
+    ui->teFeOut->append(QString("ERROR: ") + text);
     return false;
   }
 
+  ui->view3d->setScene(std::move(scene));
+  ui->teFeOut->setTextColor(Qt::black);
+  ui->teFeOut->append(text);
+
   updateAnimationList();
 
+  // typing during the eval wins over formatting what was evaluated
+  if (ui->teFeIn->document()->revision() != revision)
+    return true;
+
   try
   {
     const auto sv = ui->teFeIn->verticalScrollBar()->value();
@@ -8,6 +8,8 @@
 
 class QLineEdit;
 class QLabel;
+class QThread;
+class Scene;
 
 namespace Ui
 {
@@ -27,7 +29,7 @@ public:
 private slots:
   void on_actionnew_triggered();
   void on_actionopen_triggered();
-  bool on_actionsave_triggered();
+  void on_actionsave_triggered();
   void on_actionquit_triggered();
 
   void on_menuRecent_aboutToShow();
@@ -60,7 +62,10 @@ private:
   void addAction(const QString &name, const QKeySequence &ks, const std::function<void()> &t);
   void addAction(const QString &name, const std::function<void()> &t);
 
-  bool eval_main();
+  void saveFiles();
+
+  void eval_main(const std::function<void()> &onSuccess = {});
+  bool showEvaluation(bool ok, const QString &text, Scene &&scene, int revision);
 
 private:
   Ui::Cubes3D *ui;
@@ -72,6 +77,10 @@ private:
   QString m_editFile;
   std::unique_ptr<FeWrap> m_feWrap;
 
+  QThread *m_evalThread{nullptr};
+  bool m_evalPending{false};
+  std::function<void()> m_pendingSuccess;
+
   QVector<QPixmap> m_animation;
   int m_animationStep{0};
   bool m_animationHelper{true};
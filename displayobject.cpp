@@ -8,9 +8,7 @@ DisplayObject::DisplayObject(const QString &filename)
   : m_filename(filename)
   , m_indexBuf(QOpenGLBuffer::IndexBuffer)
   , m_numberIndices(0)
-{
-  initializeOpenGLFunctions();
-}
+{}
 
 DisplayObject::~DisplayObject()
 {
@@ -54,6 +52,9 @@ void DisplayObject::draw(QOpenGLShaderProgram &program)
 
 void DisplayObject::init()
 {
+  // created wherever a scene is evaluated, but only drawn with a current context
+  initializeOpenGLFunctions();
+
   m_data = plyImport(qPrintable(m_filename)).read();
 
   for (std::size_t i = 0; i < m_data->quads.size(); i += 4)
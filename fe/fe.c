@@ -21,6 +21,7 @@
 */
 
 #include <string.h>
+#include <stdatomic.h>
 #include "fe.h"
 
 #define unused(x)     ( (void) (x) )
@@ -28,16 +29,25 @@
 #define cdr(x)        ( (x)->cdr.o )
 #define tag(x)        ( (x)->car.c )
 #define isnil(x)      ( (x) == &nil )
-#define type(x)       ( tag(x) & 0x1 ? tag(x) >> 2 : FE_TPAIR )
+#define isimm(x)      ( IMMNUMBERS && ((size_t) (x) & IMMTAG) )
+#define type(x)       ( isimm(x) ? FE_TNUMBER : tag(x) & 0x1 ? tag(x) >> 2 : FE_TPAIR )
 #define settype(x,t)  ( tag(x) = (t) << 2 | 1 )
-#define number(x)     ( (x)->cdr.n )
+#define number(x)     ( isimm(x) ? immnumber(x) : (x)->cdr.n )
 #define prim(x)       ( (x)->cdr.c )
 #define cfunc(x)      ( (x)->cdr.f )
-#define strbuf(x)     ( &(x)->car.c + 1 )
+#define string(x)     ( (String*) cdr(x) )
 
-#define STRBUFSIZE    ( (int) sizeof(fe_Object*) - 1 )
+#define READBUFSIZE   ( 64 )
 #define GCMARKBIT     ( 0x2 )
+#define IMMTAG        ( 0x4 )
+#define IMMNUMBERS    ( sizeof(fe_Object*) >= 8 && sizeof(size_t) >= 8 &&\
+                        sizeof(fe_Number) == 4 && sizeof(unsigned) == 4 )
 #define GCSTACKSIZE   ( 256 )
+#define GCSTACKMAX    ( 1 << 15 )
+#define SYMTABSIZE    ( 512 ) /* initial buckets, must be a power of two */
+#define FRAMEBLOCK    ( 64 )
+#define EVALDEPTHMAX  ( 1 << 11 ) /* nested interpreted evals, each on the C stack */
+#define POLLSTEPS     ( 256 )
 
 
 enum {
@@ -52,40 +62,136 @@ static const char *primnames[] = {
   "<=", "+", "-", "*", "/"
 };
 
+/* internal types, never handed out through the api */
+enum { FE_TCODE = FE_TPTR + 1 };
+
 static const char *typenames[] = {
   "pair", "free", "nil", "number", "symbol", "string",
-  "func", "macro", "prim", "cfunc", "ptr"
+  "func", "macro", "prim", "cfunc", "ptr", "code"
 };
 
 typedef union { fe_Object *o; fe_CFunc f; fe_Number n; char c; } Value;
 
+/* on 64bit targets numbers are immediates: the bits of the float live in
+** the upper half of the object pointer, IMMTAG marks it; heap objects are
+** 8 byte aligned so no real pointer has that bit set */
+typedef union { unsigned u; fe_Number n; } ImmBits;
+
 struct fe_Object { Value car, cdr; };
 
+typedef struct Segment Segment;
+struct Segment { Segment *next; fe_Object *objects; int count; };
+
+/* length prefixed contents of a FE_TSTRING object, always nul terminated */
+typedef struct {
+  int len;
+  unsigned hash;
+  char data[1];
+} String;
+
+/* compiled closure body, owned by a FE_TCODE object */
+typedef struct {
+  unsigned *code;
+  fe_Object **k, **src;
+  int nk, ncode, nparams, rest, nregs;
+} Proto;
+
+#define proto(x)      ( (Proto*) cdr(x) )
+
+/* activation record of a compiled call; frames live in malloc'd blocks so
+** their calllist entries never move while linked */
+typedef struct {
+  fe_Object cl, *code;
+  const unsigned *pc;
+  int base, ret;
+} Frame;
+
+typedef struct FrameBlock FrameBlock;
+struct FrameBlock { FrameBlock *prev, *next; Frame frames[FRAMEBLOCK]; };
+
 struct fe_Context {
   fe_Handlers handlers;
-  fe_Object *gcstack[GCSTACKSIZE];
+  fe_HeapPolicy heappolicy;
+  fe_Budget budget;
+  atomic_int cancel;
+  int ticks;
+  fe_Object *gcstack_base[GCSTACKSIZE];
+  fe_Object **gcstack;
   int gcstack_idx;
-  fe_Object *objects;
+  int gcstack_size;
+  fe_Object **roots;
+  int roots_idx;
+  int roots_size;
+  int roots_free;
+  Segment heap;
   int object_count;
+  fe_Object **nursery;
+  int nursery_idx;
+  int nursery_size;
+  fe_Object **remset;
+  int remset_idx;
+  int remset_overflow;
+  fe_Object **youngset;
+  int youngset_size;
+  int gcminor;
   fe_Object *calllist;
+  FrameBlock *frames;
+  int frame_idx;
+  int frame_depth;
+  int eval_depth;
   fe_Object *freelist;
-  fe_Object *symlist;
+  fe_Object *symtable_base[SYMTABSIZE];
+  fe_Object **symtable;
+  int symtable_size;
+  int symbol_count;
   fe_Object *t;
   int nextchr;
+  char *readbuf;
+  int readbuf_size;
 };
 
 static fe_Object nil = {{ (void*) (FE_TNIL << 2 | 1) }, { NULL }};
 
 
+static fe_Number immnumber(fe_Object *obj) {
+  ImmBits b;
+  b.u = (unsigned) ((size_t) obj >> 16 >> 16);
+  return b.n;
+}
+
+
 fe_Handlers* fe_handlers(fe_Context *ctx) {
   return &ctx->handlers;
 }
 
 
+fe_HeapPolicy* fe_heappolicy(fe_Context *ctx) {
+  return &ctx->heappolicy;
+}
+
+
+fe_Budget* fe_budget(fe_Context *ctx) {
+  return &ctx->budget;
+}
+
+
+/* the only call that may be made from another thread than the evaluating one */
+void fe_cancel(fe_Context *ctx, int cancel) {
+  atomic_store(&ctx->cancel, cancel);
+}
+
+
+int fe_cancelled(fe_Context *ctx) {
+  return atomic_load(&ctx->cancel);
+}
+
+
 void fe_error(fe_Context *ctx, const char *msg) {
   fe_Object *cl = ctx->calllist;
   /* reset context state */
   ctx->calllist = &nil;
+  while (ctx->frames && ctx->frames->prev) { ctx->frames = ctx->frames->prev; }
+  ctx->frame_idx = ctx->frame_depth = ctx->eval_depth = 0;
   /* do error handler */
   if (ctx->handlers.error) { ctx->handlers.error(ctx, msg, cl); }
   /* error handler returned -- print error and traceback, exit */
@@ -132,9 +238,22 @@ int fe_isnil(fe_Context *ctx, fe_Object *obj) {
 }
 
 
+static void growgcstack(fe_Context *ctx) {
+  fe_Object **stack;
+  int size = ctx->gcstack_size * 2;
+  if (size > GCSTACKMAX) { fe_error(ctx, "gc stack overflow"); }
+  stack = malloc(size * sizeof(fe_Object*));
+  if (!stack) { fe_error(ctx, "gc stack overflow"); }
+  memcpy(stack, ctx->gcstack, ctx->gcstack_idx * sizeof(fe_Object*));
+  if (ctx->gcstack != ctx->gcstack_base) { free(ctx->gcstack); }
+  ctx->gcstack = stack;
+  ctx->gcstack_size = size;
+}
+
+
 void fe_pushgc(fe_Context *ctx, fe_Object *obj) {
-  if (ctx->gcstack_idx == GCSTACKSIZE) {
-    fe_error(ctx, "gc stack overflow");
+  if (ctx->gcstack_idx == ctx->gcstack_size) {
+    growgcstack(ctx);
   }
   ctx->gcstack[ctx->gcstack_idx++] = obj;
 }
@@ -150,10 +269,52 @@ int fe_savegc(fe_Context *ctx) {
 }
 
 
+int fe_addroot(fe_Context *ctx, fe_Object *obj) {
+  int root = ctx->roots_free;
+  if (root >= 0) {
+    ctx->roots_free = (int) ((size_t) ctx->roots[root] >> 3) - 1;
+  } else {
+    if (ctx->roots_idx == ctx->roots_size) {
+      int size = ctx->roots_size ? ctx->roots_size * 2 : 64;
+      fe_Object **roots = realloc(ctx->roots, size * sizeof(fe_Object*));
+      if (!roots) { fe_error(ctx, "out of memory"); }
+      ctx->roots = roots;
+      ctx->roots_size = size;
+    }
+    root = ctx->roots_idx++;
+  }
+  ctx->roots[root] = obj;
+  return root;
+}
+
+
+void fe_removeroot(fe_Context *ctx, int root) {
+  /* a free slot holds the next free one; odd, so marking skips it */
+  ctx->roots[root] = (fe_Object*) ((size_t) (ctx->roots_free + 1) << 3 | 1);
+  ctx->roots_free = root;
+}
+
+
+#define ptrhash(p)    ( (unsigned) ((size_t) (p) / sizeof(fe_Object)) * 2654435761u )
+
+static int isyoung(fe_Context *ctx, fe_Object *obj) {
+  unsigned mask = ctx->youngset_size - 1;
+  unsigned i = ptrhash(obj) & mask;
+  for (; ctx->youngset[i]; i = (i + 1) & mask) {
+    if (ctx->youngset[i] == obj) { return 1; }
+  }
+  return 0;
+}
+
+
 void fe_mark(fe_Context *ctx, fe_Object *obj) {
   fe_Object *car;
+  int i;
 begin:
+  if (isimm(obj)) { return; }
   if (tag(obj) & GCMARKBIT) { return; }
+  /* a minor collection treats every old object as live */
+  if (ctx->gcminor && !isyoung(ctx, obj)) { return; }
   car = car(obj); /* store car before modifying it with GCMARKBIT */
   tag(obj) |= GCMARKBIT;
 
@@ -161,39 +322,217 @@ begin:
     case FE_TPAIR:
       fe_mark(ctx, car);
       /* fall through */
-    case FE_TFUNC: case FE_TMACRO: case FE_TSYMBOL: case FE_TSTRING:
+    case FE_TFUNC: case FE_TMACRO: case FE_TSYMBOL:
       obj = cdr(obj);
       goto begin;
 
     case FE_TPTR:
       if (ctx->handlers.mark) { ctx->handlers.mark(ctx, obj); }
       break;
+
+    case FE_TCODE:
+      if (proto(obj)) {
+        for (i = 0; i < proto(obj)->nk; i++) { fe_mark(ctx, proto(obj)->k[i]); }
+        /* the forms stay alive for calllist entries and tracebacks, even if
+        ** the closure owning the code is collected while it runs */
+        for (i = 0; i < proto(obj)->ncode; i++) { fe_mark(ctx, proto(obj)->src[i]); }
+      }
+      break;
   }
 }
 
 
-static void collectgarbage(fe_Context *ctx) {
+static void markroots(fe_Context *ctx) {
   int i;
-  /* mark */
   for (i = 0; i < ctx->gcstack_idx; i++) {
     fe_mark(ctx, ctx->gcstack[i]);
   }
-  fe_mark(ctx, ctx->symlist);
+  for (i = 0; i < ctx->symtable_size; i++) {
+    fe_mark(ctx, ctx->symtable[i]);
+  }
+  for (i = 0; i < ctx->roots_idx; i++) {
+    if ((size_t) ctx->roots[i] & 1) { continue; }
+    fe_mark(ctx, ctx->roots[i]);
+  }
+}
+
+
+static void freeobject(fe_Context *ctx, fe_Object *obj) {
+  if (type(obj) == FE_TPTR && ctx->handlers.gc) {
+    ctx->handlers.gc(ctx, obj);
+  }
+  if (type(obj) == FE_TCODE) { free(proto(obj)); }
+  if (type(obj) == FE_TSTRING) { free(string(obj)); }
+  settype(obj, FE_TFREE);
+  cdr(obj) = ctx->freelist;
+  ctx->freelist = obj;
+}
+
+
+static int collectgarbage(fe_Context *ctx) {
+  Segment *seg;
+  int i, freed = 0;
+  /* mark */
+  markroots(ctx);
   /* sweep and unmark */
-  for (i = 0; i < ctx->object_count; i++) {
-    fe_Object *obj = &ctx->objects[i];
-    if (type(obj) == FE_TFREE) { continue; }
-    if (~tag(obj) & GCMARKBIT) {
-      if (type(obj) == FE_TPTR && ctx->handlers.gc) {
-        ctx->handlers.gc(ctx, obj);
+  for (seg = &ctx->heap; seg; seg = seg->next) {
+    for (i = 0; i < seg->count; i++) {
+      fe_Object *obj = &seg->objects[i];
+      if (type(obj) == FE_TFREE) { freed++; continue; }
+      if (~tag(obj) & GCMARKBIT) {
+        freeobject(ctx, obj);
+        freed++;
+      } else {
+        tag(obj) &= ~GCMARKBIT;
       }
-      settype(obj, FE_TFREE);
-      cdr(obj) = ctx->freelist;
-      ctx->freelist = obj;
+    }
+  }
+  /* every survivor is old now */
+  ctx->nursery_idx = 0;
+  ctx->remset_idx = 0;
+  ctx->remset_overflow = 0;
+  return freed;
+}
+
+
+static int collectnursery(fe_Context *ctx) {
+  unsigned mask = ctx->youngset_size - 1;
+  int i, freed = 0;
+  /* index the young objects so marking can stop at old ones */
+  memset(ctx->youngset, 0, ctx->youngset_size * sizeof(fe_Object*));
+  for (i = 0; i < ctx->nursery_idx; i++) {
+    unsigned h = ptrhash(ctx->nursery[i]) & mask;
+    while (ctx->youngset[h]) { h = (h + 1) & mask; }
+    ctx->youngset[h] = ctx->nursery[i];
+  }
+  /* mark from the roots and from old objects written since the last
+  ** collection; those may hold the only reference to a young object */
+  ctx->gcminor = 1;
+  markroots(ctx);
+  for (i = 0; i < ctx->remset_idx; i++) {
+    fe_Object *obj = ctx->remset[i];
+    if (isyoung(ctx, obj)) { continue; }
+    switch (type(obj)) {
+      case FE_TPAIR:
+        fe_mark(ctx, car(obj));
+        /* fall through */
+      case FE_TFUNC: case FE_TMACRO: case FE_TSYMBOL:
+        fe_mark(ctx, cdr(obj));
+        break;
+
+      case FE_TPTR:
+        if (ctx->handlers.mark) { ctx->handlers.mark(ctx, obj); }
+        break;
+    }
+  }
+  ctx->gcminor = 0;
+  /* sweep the young objects only; survivors are promoted by forgetting them */
+  for (i = 0; i < ctx->nursery_idx; i++) {
+    fe_Object *obj = ctx->nursery[i];
+    if (~tag(obj) & GCMARKBIT) {
+      freeobject(ctx, obj);
+      freed++;
     } else {
       tag(obj) &= ~GCMARKBIT;
     }
   }
+  ctx->nursery_idx = 0;
+  ctx->remset_idx = 0;
+  return freed;
+}
+
+
+static void freenursery(fe_Context *ctx) {
+  free(ctx->nursery);
+  free(ctx->remset);
+  free(ctx->youngset);
+  ctx->nursery = ctx->remset = ctx->youngset = NULL;
+  ctx->nursery_size = ctx->youngset_size = 0;
+}
+
+
+static void initnursery(fe_Context *ctx) {
+  int size = ctx->heappolicy.nursery;
+  /* promote everything allocated so far */
+  collectgarbage(ctx);
+  freenursery(ctx);
+  if (size <= 0) { return; }
+  ctx->youngset_size = 1;
+  while (ctx->youngset_size < size * 2) { ctx->youngset_size <<= 1; }
+  ctx->nursery = malloc(size * sizeof(fe_Object*));
+  ctx->remset = malloc(size * sizeof(fe_Object*));
+  ctx->youngset = malloc(ctx->youngset_size * sizeof(fe_Object*));
+  if (!ctx->nursery || !ctx->remset || !ctx->youngset) {
+    /* fall back to full collections only */
+    freenursery(ctx);
+    ctx->heappolicy.nursery = 0;
+    return;
+  }
+  ctx->nursery_size = size;
+}
+
+
+static void writebarrier(fe_Context *ctx, fe_Object *obj) {
+  /* remember objects which may now point to young objects */
+  if (!ctx->nursery_size) { return; }
+  if (ctx->remset_idx > 0 && ctx->remset[ctx->remset_idx - 1] == obj) { return; }
+  if (ctx->remset_idx == ctx->nursery_size) {
+    ctx->remset_overflow = 1;
+    return;
+  }
+  ctx->remset[ctx->remset_idx++] = obj;
+}
+
+
+static void written(fe_Context *ctx, fe_Object *obj) {
+  /* tells the host about the symbol of a global or a pair changing */
+  if (ctx->handlers.write) { ctx->handlers.write(ctx, obj); }
+}
+
+
+static fe_Object* bindingsymbol(fe_Context *ctx, fe_Object *cell) {
+  /* the symbol of a global binding cell, which holds its name where a
+  ** local one holds the symbol */
+  fe_Object *obj = ctx->symtable[string(car(cell))->hash & (ctx->symtable_size - 1)];
+  for (; !isnil(obj); obj = cdr(obj)) {
+    if (cdr(car(obj)) == cell) { return car(obj); }
+  }
+  return &nil;
+}
+
+
+static void addsegment(fe_Context *ctx, Segment *seg, fe_Object *objects, int count) {
+  int i;
+  seg->objects = objects;
+  seg->count = count;
+  for (i = 0; i < count; i++) {
+    fe_Object *obj = &objects[i];
+    settype(obj, FE_TFREE);
+    cdr(obj) = ctx->freelist;
+    ctx->freelist = obj;
+  }
+  ctx->object_count += count;
+}
+
+
+static int growheap(fe_Context *ctx) {
+  fe_HeapPolicy *hp = &ctx->heappolicy;
+  Segment *seg;
+  int count;
+  if (hp->segment <= 0) { return 0; }
+  count = ctx->object_count / 100 * hp->growth;
+  if (count < hp->segment) { count = hp->segment; }
+  if (hp->limit > 0 && ctx->object_count + count > hp->limit) {
+    count = hp->limit - ctx->object_count;
+  }
+  if (count <= 0) { return 0; }
+  seg = malloc(sizeof(Segment) + count * sizeof(fe_Object));
+  if (!seg) { return 0; }
+  addsegment(ctx, seg, (fe_Object*) (seg + 1), count);
+  /* link in after the initial segment, which lives in the context memory */
+  seg->next = ctx->heap.next;
+  ctx->heap.next = seg;
+  return 1;
 }
 
 
@@ -202,39 +541,43 @@ static int equal(fe_Object *a, fe_Object *b) {
   if (type(a) != type(b)) { return 0; }
   if (type(a) == FE_TNUMBER) { return number(a) == number(b); }
   if (type(a) == FE_TSTRING) {
-    for (; !isnil(a); a = cdr(a), b = cdr(b)) {
-      if (car(a) != car(b)) { return 0; }
-    }
-    return a == b;
+    return string(a)->len == string(b)->len && string(a)->hash == string(b)->hash &&
+           memcmp(string(a)->data, string(b)->data, string(a)->len) == 0;
   }
   return 0;
 }
 
 
 static int streq(fe_Object *obj, const char *str) {
-  while (!isnil(obj)) {
-    int i;
-    for (i = 0; i < STRBUFSIZE; i++) {
-      if (strbuf(obj)[i] != *str) { return 0; }
-      if (*str) { str++; }
-    }
-    obj = cdr(obj);
-  }
-  return *str == '\0';
+  return strcmp(string(obj)->data, str) == 0;
 }
 
 
 static fe_Object* object(fe_Context *ctx) {
   fe_Object *obj;
-  /* do gc if freelist has no more objects */
+  if (ctx->heappolicy.nursery != ctx->nursery_size) { initnursery(ctx); }
+  /* collect the young objects once the nursery or the remembered set is
+  ** full; a remembered set that overflowed needs a full collection */
+  if (ctx->nursery_size && (ctx->nursery_idx == ctx->nursery_size ||
+                            ctx->remset_idx == ctx->nursery_size)) {
+    if (ctx->remset_overflow) {
+      collectgarbage(ctx);
+    } else {
+      collectnursery(ctx);
+    }
+  }
+  /* do gc if freelist has no more objects; grow the heap instead of
+  ** collecting over and over again if less than a quarter was freed */
   if (isnil(ctx->freelist)) {
-    collectgarbage(ctx);
+    int freed = collectgarbage(ctx);
+    if (freed < ctx->object_count / 4) { growheap(ctx); }
     if (isnil(ctx->freelist)) { fe_error(ctx, "out of memory"); }
   }
   /* get object from freelist and push to the gcstack */
   obj = ctx->freelist;
   ctx->freelist = cdr(obj);
   fe_pushgc(ctx, obj);
+  if (ctx->nursery_size) { ctx->nursery[ctx->nursery_idx++] = obj; }
   return obj;
 }
 
@@ -253,55 +596,100 @@ fe_Object* fe_bool(fe_Context *ctx, int b) {
 
 
 fe_Object* fe_number(fe_Context *ctx, fe_Number n) {
-  fe_Object *obj = object(ctx);
+  fe_Object *obj;
+  if (IMMNUMBERS) {
+    ImmBits b;
+    b.n = n;
+    return (fe_Object*) ((size_t) b.u << 16 << 16 | IMMTAG);
+  }
+  obj = object(ctx);
   settype(obj, FE_TNUMBER);
-  number(obj) = n;
+  obj->cdr.n = n;
   return obj;
 }
 
 
-static fe_Object* buildstring(fe_Context *ctx, fe_Object *tail, int chr) {
-  if (!tail || strbuf(tail)[STRBUFSIZE - 1] != '\0') {
-    fe_Object *obj = fe_cons(ctx, NULL, &nil);
-    settype(obj, FE_TSTRING);
-    if (tail) {
-      cdr(tail) = obj;
-      ctx->gcstack_idx--;
-    }
-    tail = obj;
-  }
-  strbuf(tail)[strlen(strbuf(tail))] = chr;
-  return tail;
+static unsigned strhash(const char *str, int len) {
+  /* FNV-1a */
+  unsigned h = 2166136261u;
+  while (len--) { h = (h ^ (unsigned char) *str++) * 16777619u; }
+  return h;
+}
+
+
+static fe_Object* buildstring(fe_Context *ctx, const char *str, int len) {
+  String *s;
+  fe_Object *obj = object(ctx);
+  settype(obj, FE_TSTRING);
+  cdr(obj) = NULL;
+  s = malloc(sizeof(String) + len);
+  if (!s) { fe_error(ctx, "out of memory"); }
+  s->len = len;
+  s->hash = strhash(str, len);
+  memcpy(s->data, str, len);
+  s->data[len] = '\0';
+  cdr(obj) = (fe_Object*) s;
+  return obj;
 }
 
 
 fe_Object* fe_string(fe_Context *ctx, const char *str) {
-  fe_Object *obj = buildstring(ctx, NULL, '\0');
-  fe_Object *tail = obj;
-  while (*str) {
-    tail = buildstring(ctx, tail, *str++);
+  return buildstring(ctx, str, (int) strlen(str));
+}
+
+
+static void growsymtable(fe_Context *ctx) {
+  /* relinks the bucket pairs into twice the buckets; keeps the old table
+  ** if there is no memory, that only makes the buckets longer */
+  int i, size = ctx->symtable_size * 2;
+  fe_Object **table = malloc(size * sizeof(fe_Object*));
+  if (!table) { return; }
+  for (i = 0; i < size; i++) { table[i] = &nil; }
+  for (i = 0; i < ctx->symtable_size; i++) {
+    fe_Object *lst = ctx->symtable[i];
+    while (!isnil(lst)) {
+      fe_Object *next = cdr(lst);
+      fe_Object **bucket = &table[string(car(cdr(car(lst))))->hash & (size - 1)];
+      cdr(lst) = *bucket;
+      writebarrier(ctx, lst);
+      *bucket = lst;
+      lst = next;
+    }
   }
-  return obj;
+  if (ctx->symtable != ctx->symtable_base) { free(ctx->symtable); }
+  ctx->symtable = table;
+  ctx->symtable_size = size;
 }
 
 
-fe_Object* fe_symbol(fe_Context *ctx, const char *name) {
-  fe_Object *obj;
-  /* try to find in symlist */
-  for (obj = ctx->symlist; !isnil(obj); obj = cdr(obj)) {
-    if (streq(car(cdr(car(obj))), name)) {
+static fe_Object* symbol(fe_Context *ctx, const char *name, int len) {
+  fe_Object *obj, *v;
+  unsigned h = strhash(name, len);
+  fe_Object **bucket = &ctx->symtable[h & (ctx->symtable_size - 1)];
+  /* try to find in symbol table bucket */
+  for (obj = *bucket; !isnil(obj); obj = cdr(obj)) {
+    String *s = string(car(cdr(car(obj))));
+    if (s->hash == h && s->len == len && memcmp(s->data, name, len) == 0) {
       return car(obj);
     }
   }
-  /* create new object, push to symlist and return */
+  /* create new object, push to bucket and return */
+  v = fe_cons(ctx, buildstring(ctx, name, len), &nil);
   obj = object(ctx);
   settype(obj, FE_TSYMBOL);
-  cdr(obj) = fe_cons(ctx, fe_string(ctx, name), &nil);
-  ctx->symlist = fe_cons(ctx, obj, ctx->symlist);
+  cdr(obj) = v;
+  *bucket = fe_cons(ctx, obj, *bucket);
+  /* keep buckets at two symbols on average */
+  if (++ctx->symbol_count > ctx->symtable_size * 2) { growsymtable(ctx); }
   return obj;
 }
 
 
+fe_Object* fe_symbol(fe_Context *ctx, const char *name) {
+  return symbol(ctx, name, (int) strlen(name));
+}
+
+
 fe_Object* fe_cfunc(fe_Context *ctx, fe_CFunc fn) {
   fe_Object *obj = object(ctx);
   settype(obj, FE_TCFUNC);
@@ -345,6 +733,7 @@ static void writestr(fe_Context *ctx, fe_WriteFn fn, void *udata, const char *s)
 
 void fe_write(fe_Context *ctx, fe_Object *obj, fe_WriteFn fn, void *udata, int qt) {
   char buf[32];
+  int i;
 
   switch (type(obj)) {
     case FE_TNIL:
@@ -377,13 +766,9 @@ void fe_write(fe_Context *ctx, fe_Object *obj, fe_WriteFn fn, void *udata, int q
 
     case FE_TSTRING:
       if (qt) { fn(ctx, udata, '"'); }
-      while (!isnil(obj)) {
-        int i;
-        for (i = 0; i < STRBUFSIZE && strbuf(obj)[i]; i++) {
-          if (qt && strbuf(obj)[i] == '"') { fn(ctx, udata, '\\'); }
-          fn(ctx, udata, strbuf(obj)[i]);
-        }
-        obj = cdr(obj);
+      for (i = 0; i < string(obj)->len; i++) {
+        if (qt && string(obj)->data[i] == '"') { fn(ctx, udata, '\\'); }
+        fn(ctx, udata, string(obj)->data[i]);
       }
       if (qt) { fn(ctx, udata, '"'); }
       break;
@@ -434,6 +819,16 @@ void* fe_toptr(fe_Context *ctx, fe_Object *obj) {
 }
 
 
+/* a closure is (env params ...) or, once compiled, (env code params ...) */
+static fe_Object* closurecode(fe_Object *va) {
+  return type(car(cdr(va))) == FE_TCODE ? car(cdr(va)) : NULL;
+}
+
+static fe_Object* closureparams(fe_Object *va) {
+  return closurecode(va) ? cdr(cdr(va)) : cdr(va);
+}
+
+
 static fe_Object* getbound(fe_Object *sym, fe_Object *env) {
   /* try to find in environment */
   for (; !isnil(env); env = cdr(env)) {
@@ -445,28 +840,162 @@ static fe_Object* getbound(fe_Object *sym, fe_Object *env) {
 }
 
 
+static String* checkstring(fe_Context *ctx, fe_Object *obj) {
+  /* a symbol stands for its name */
+  if (type(obj) == FE_TSYMBOL) { obj = car(cdr(obj)); }
+  return string(checktype(ctx, obj, FE_TSTRING));
+}
+
+
+int fe_strlen(fe_Context *ctx, fe_Object *obj) {
+  return checkstring(ctx, obj)->len;
+}
+
+
+const char* fe_strptr(fe_Context *ctx, fe_Object *obj) {
+  return checkstring(ctx, obj)->data;
+}
+
+
+fe_CFunc fe_tocfunc(fe_Context *ctx, fe_Object *obj) {
+  return cfunc(checktype(ctx, obj, FE_TCFUNC));
+}
+
+
+const char* fe_primname(fe_Context *ctx, fe_Object *obj) {
+  return primnames[(int) prim(checktype(ctx, obj, FE_TPRIM))];
+}
+
+
+static fe_Object* checkclosure(fe_Context *ctx, fe_Object *obj) {
+  if (type(obj) != FE_TMACRO) { checktype(ctx, obj, FE_TFUNC); }
+  return cdr(obj);
+}
+
+
+fe_Object* fe_fnparams(fe_Context *ctx, fe_Object *fn) {
+  return car(closureparams(checkclosure(ctx, fn)));
+}
+
+
+fe_Object* fe_fnbody(fe_Context *ctx, fe_Object *fn) {
+  return cdr(closureparams(checkclosure(ctx, fn)));
+}
+
+
+fe_Object* fe_fnlookup(fe_Context *ctx, fe_Object *fn, fe_Object *sym) {
+  /* value of sym as seen from the body of fn, ignoring its parameters */
+  return cdr(getbound(checktype(ctx, sym, FE_TSYMBOL), car(checkclosure(ctx, fn))));
+}
+
+
+fe_Object* fe_fnlocal(fe_Context *ctx, fe_Object *fn, fe_Object *sym) {
+  /* value of sym in the environment fn closed over, NULL if it is only
+  ** bound globally */
+  fe_Object *env = car(checkclosure(ctx, fn));
+  checktype(ctx, sym, FE_TSYMBOL);
+  for (; !isnil(env); env = cdr(env)) {
+    if (car(car(env)) == sym) { return cdr(car(env)); }
+  }
+  return NULL;
+}
+
+
 void fe_set(fe_Context *ctx, fe_Object *sym, fe_Object *v) {
-  unused(ctx);
-  cdr(getbound(sym, &nil)) = v;
+  fe_Object *x = getbound(sym, &nil);
+  cdr(x) = v;
+  writebarrier(ctx, x);
+}
+
+
+fe_Object* fe_snapshot(fe_Context *ctx) {
+  /* the current global bindings as a list of (symbol . value), for
+  ** restoring them later with fe_set */
+  fe_Object *res = &nil, *lst, *sym;
+  int i, gc = fe_savegc(ctx);
+  for (i = 0; i < ctx->symtable_size; i++) {
+    for (lst = ctx->symtable[i]; !isnil(lst); lst = cdr(lst)) {
+      sym = car(lst);
+      if (isnil(cdr(cdr(sym)))) { continue; }
+      res = fe_cons(ctx, fe_cons(ctx, sym, cdr(cdr(sym))), res);
+      fe_restoregc(ctx, gc);
+      fe_pushgc(ctx, res);
+    }
+  }
+  return res;
 }
 
 
 static fe_Object rparen;
 
-static fe_Object* read_(fe_Context *ctx, fe_ReadFn fn, void *udata) {
+/* source of characters, either a callback or a span of memory */
+typedef struct {
+  fe_ReadFn fn;
+  void *udata;
+  const char *p, *end;
+} Reader;
+
+static int readchr(fe_Context *ctx, Reader *r) {
+  if (r->fn) { return r->fn(ctx, r->udata); }
+  return r->p < r->end ? *r->p++ : '\0';
+}
+
+
+static fe_Object* readtoken(fe_Context *ctx, Reader *r) {
+  /* a number or symbol read in place from a span; decimals short enough to
+  ** be exact in a double skip strtod, as do tokens it can't parse */
   const char *delimiter = " \n\t\r();";
-  fe_Object *v, *res, **tail;
+  const char *s = r->p - 1, *p = s;
+  double m = 0, d = 1;
+  int digits = 0, len;
+  char buf[64], *q;
+
+  while (p < r->end && *p && !strchr(delimiter, *p)) { p++; }
+  r->p = p;
+  len = (int) (p - s);
+  if (len >= (int) sizeof(buf)) { fe_error(ctx, "symbol too long"); }
+
+  p = s + (*s == '-' || *s == '+');
+  for (; p < r->p && *p >= '0' && *p <= '9'; p++, digits++) {
+    m = m * 10 + (*p - '0');
+  }
+  if (p < r->p && *p == '.') {
+    for (p++; p < r->p && *p >= '0' && *p <= '9'; p++, digits++) {
+      m = m * 10 + (*p - '0');
+      d *= 10;
+    }
+  }
+  if (p == r->p && digits > 0 && digits <= 15) {
+    return fe_number(ctx, (fe_Number) ((*s == '-' ? -m : m) / d));
+  }
+
+  if (strchr("+-.0123456789iInN", *s)) {
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+    m = strtod(buf, &q);  /* try to read as number */
+    if (q != buf && *q == '\0') { return fe_number(ctx, m); }
+  }
+  if (len == 3 && !memcmp(s, "nil", 3)) { return &nil; }
+  return symbol(ctx, s, len);
+}
+
+
+static fe_Object* readform(fe_Context *ctx, Reader *r);
+
+static fe_Object* read_(fe_Context *ctx, Reader *r) {
+  const char *delimiter = " \n\t\r();";
+  fe_Object *v, *res, *last, **tail;
   fe_Number n;
-  int chr, gc;
+  int chr, gc, len;
   char buf[64], *p;
 
   /* get next character */
-  chr = ctx->nextchr ? ctx->nextchr : fn(ctx, udata);
+  chr = ctx->nextchr ? ctx->nextchr : readchr(ctx, r);
   ctx->nextchr = '\0';
 
   /* skip whitespace */
   while (chr && strchr(" \n\t\r", chr)) {
-    chr = fn(ctx, udata);
+    chr = readchr(ctx, r);
   }
 
   switch (chr) {
@@ -474,26 +1003,30 @@ static fe_Object* read_(fe_Context *ctx, fe_ReadFn fn, void *udata) {
       return NULL;
 
     case ';':
-      while (chr && chr != '\n') { chr = fn(ctx, udata); }
-      return read_(ctx, fn, udata);
+      while (chr && chr != '\n') { chr = readchr(ctx, r); }
+      return read_(ctx, r);
 
     case ')':
       return &rparen;
 
     case '(':
       res = &nil;
+      last = NULL;
       tail = &res;
       gc = fe_savegc(ctx);
       fe_pushgc(ctx, res); /* to cause error on too-deep nesting */
-      while ( (v = read_(ctx, fn, udata)) != &rparen ) {
+      while ( (v = read_(ctx, r)) != &rparen ) {
         if (v == NULL) { fe_error(ctx, "unclosed list"); }
         if (type(v) == FE_TSYMBOL && streq(car(cdr(v)), ".")) {
           /* dotted pair */
-          *tail = fe_read(ctx, fn, udata);
+          *tail = readform(ctx, r);
+          if (last) { writebarrier(ctx, last); }
         } else {
           /* proper pair */
           *tail = fe_cons(ctx, v, &nil);
-          tail = &cdr(*tail);
+          if (last) { writebarrier(ctx, last); }
+          last = *tail;
+          tail = &cdr(last);
         }
         fe_restoregc(ctx, gc);
         fe_pushgc(ctx, res);
@@ -501,31 +1034,38 @@ static fe_Object* read_(fe_Context *ctx, fe_ReadFn fn, void *udata) {
       return res;
 
     case '\'':
-      v = fe_read(ctx, fn, udata);
+      v = readform(ctx, r);
       if (!v) { fe_error(ctx, "stray '''"); }
       return fe_cons(ctx, fe_symbol(ctx, "quote"), fe_cons(ctx, v, &nil));
 
     case '"':
-      res = buildstring(ctx, NULL, '\0');
-      v = res;
-      chr = fn(ctx, udata);
+      /* gather the contents in the context's read buffer, then copy once */
+      len = 0;
+      chr = readchr(ctx, r);
       while (chr != '"') {
         if (chr == '\0') { fe_error(ctx, "unclosed string"); }
         if (chr == '\\') {
-          chr = fn(ctx, udata);
+          chr = readchr(ctx, r);
           if (strchr("nrt", chr)) { chr = strchr("n\nr\rt\t", chr)[1]; }
         }
-        v = buildstring(ctx, v, chr);
-        chr = fn(ctx, udata);
+        if (len == ctx->readbuf_size) {
+          p = realloc(ctx->readbuf, len ? len * 2 : READBUFSIZE);
+          if (!p) { fe_error(ctx, "out of memory"); }
+          ctx->readbuf = p;
+          ctx->readbuf_size = len ? len * 2 : READBUFSIZE;
+        }
+        ctx->readbuf[len++] = chr;
+        chr = readchr(ctx, r);
       }
-      return res;
+      return buildstring(ctx, ctx->readbuf, len);
 
     default:
+      if (!r->fn) { return readtoken(ctx, r); }
       p = buf;
       do {
         if (p == buf + sizeof(buf) - 1) { fe_error(ctx, "symbol too long"); }
         *p++ = chr;
-        chr = fn(ctx, udata);
+        chr = readchr(ctx, r);
       } while (chr && !strchr(delimiter, chr));
       *p = '\0';
       ctx->nextchr = chr;
@@ -537,13 +1077,31 @@ static fe_Object* read_(fe_Context *ctx, fe_ReadFn fn, void *udata) {
 }
 
 
-fe_Object* fe_read(fe_Context *ctx, fe_ReadFn fn, void *udata) {
-  fe_Object* obj = read_(ctx, fn, udata);
+static fe_Object* readform(fe_Context *ctx, Reader *r) {
+  fe_Object* obj = read_(ctx, r);
   if (obj == &rparen) { fe_error(ctx, "stray ')'"); }
   return obj;
 }
 
 
+fe_Object* fe_read(fe_Context *ctx, fe_ReadFn fn, void *udata) {
+  Reader r;
+  r.fn = fn, r.udata = udata, r.p = r.end = NULL;
+  return readform(ctx, &r);
+}
+
+
+fe_Object* fe_readspan(fe_Context *ctx, const char **ptr, const char *end) {
+  /* reads the next form from [*ptr, end) and moves *ptr past it */
+  fe_Object *obj;
+  Reader r;
+  r.fn = NULL, r.udata = NULL, r.p = *ptr, r.end = end;
+  obj = readform(ctx, &r);
+  *ptr = r.p;
+  return obj;
+}
+
+
 static char readfp(fe_Context *ctx, void *udata) {
   int chr;
   unused(ctx);
@@ -556,13 +1114,18 @@ fe_Object* fe_readfp(fe_Context *ctx, FILE *fp) {
 
 
 static fe_Object* eval(fe_Context *ctx, fe_Object *obj, fe_Object *env, fe_Object **bind);
+static fe_Object* compiledcode(fe_Context *ctx, fe_Object *fn);
+static fe_Object* execute(fe_Context *ctx, fe_Object *code, int argc);
 
 static fe_Object* evallist(fe_Context *ctx, fe_Object *lst, fe_Object *env) {
   fe_Object *res = &nil;
+  fe_Object *last = NULL;
   fe_Object **tail = &res;
   while (!isnil(lst)) {
     *tail = fe_cons(ctx, eval(ctx, fe_nextarg(ctx, &lst), env, NULL), &nil);
-    tail = &cdr(*tail);
+    if (last) { writebarrier(ctx, last); }
+    last = *tail;
+    tail = &cdr(last);
   }
   return res;
 }
@@ -581,6 +1144,22 @@ static fe_Object* dolist(fe_Context *ctx, fe_Object *lst, fe_Object *env) {
 }
 
 
+static fe_Object* lastform(fe_Context *ctx, fe_Object *lst, fe_Object **env) {
+  /* like dolist, but returns the last form unevaluated for a tail call */
+  fe_Object *x = &nil;
+  int save = fe_savegc(ctx);
+  while (!isnil(lst)) {
+    fe_restoregc(ctx, save);
+    fe_pushgc(ctx, lst);
+    fe_pushgc(ctx, *env);
+    x = fe_nextarg(ctx, &lst);
+    if (isnil(lst)) { break; }
+    eval(ctx, x, *env, env);
+  }
+  return x;
+}
+
+
 static fe_Object* argstoenv(fe_Context *ctx, fe_Object *prm, fe_Object *arg, fe_Object *env) {
   while (!isnil(prm)) {
     if (type(prm) != FE_TPAIR) {
@@ -597,6 +1176,19 @@ static fe_Object* argstoenv(fe_Context *ctx, fe_Object *prm, fe_Object *arg, fe_
 
 #define evalarg() eval(ctx, fe_nextarg(ctx, &arg), env, NULL)
 
+/* counts an evaluation step, the budget is only looked at every POLLSTEPS */
+#define step(ctx) { if (--(ctx)->ticks < 0) { pollbudget(ctx); } }
+
+static void pollbudget(fe_Context *ctx) {
+  fe_Budget *b = &ctx->budget;
+  ctx->ticks = POLLSTEPS;
+  if (atomic_load(&ctx->cancel) || (b->poll && b->poll(ctx))) { fe_error(ctx, "evaluation cancelled"); }
+  if (b->steps >= 0) {
+    if (b->steps < POLLSTEPS) { b->steps = 0; fe_error(ctx, "step budget exceeded"); }
+    b->steps -= POLLSTEPS;
+  }
+}
+
 #define arithop(op) {                             \
     fe_Number x = fe_tonumber(ctx, evalarg());    \
     while (!isnil(arg)) {                         \
@@ -605,6 +1197,17 @@ static fe_Object* argstoenv(fe_Context *ctx, fe_Object *prm, fe_Object *arg, fe_
     res = fe_number(ctx, x);                      \
   }
 
+/* continues this eval with x in place of obj instead of recursing, so
+** calls in tail position run in constant C stack and gcstack space */
+#define evaltail(x, e, ne) {                                          \
+    obj = (x), env = (e), newenv = (ne);                              \
+    fe_restoregc(ctx, gc);                                            \
+    fe_pushgc(ctx, obj);                                              \
+    fe_pushgc(ctx, env);                                              \
+    if (type(obj) == FE_TPAIR) { car(&cl) = obj; goto tailcall; }     \
+    res = eval(ctx, obj, env, NULL);                                  \
+  }
+
 #define numcmpop(op) {                            \
     va = checktype(ctx, evalarg(), FE_TNUMBER);   \
     vb = checktype(ctx, evalarg(), FE_TNUMBER);   \
@@ -614,16 +1217,20 @@ static fe_Object* argstoenv(fe_Context *ctx, fe_Object *prm, fe_Object *arg, fe_
 
 static fe_Object* eval(fe_Context *ctx, fe_Object *obj, fe_Object *env, fe_Object **newenv) {
   fe_Object *fn, *arg, *res;
-  fe_Object cl, *va, *vb;
+  fe_Object cl, *va, *vb, *scratch;
   int n, gc;
 
   if (type(obj) == FE_TSYMBOL) { return cdr(getbound(obj, env)); }
   if (type(obj) != FE_TPAIR) { return obj; }
 
+  /* compiled calls nest on the frame stack, only interpreted ones recurse */
+  if (++ctx->eval_depth > EVALDEPTHMAX) { fe_error(ctx, "eval depth exceeded"); }
   car(&cl) = obj, cdr(&cl) = ctx->calllist;
   ctx->calllist = &cl;
 
   gc = fe_savegc(ctx);
+tailcall:
+  step(ctx);
   fn = eval(ctx, car(obj), env, NULL);
   arg = cdr(obj);
   res = &nil;
@@ -640,17 +1247,25 @@ static fe_Object* eval(fe_Context *ctx, fe_Object *obj, fe_Object *env, fe_Objec
 
         case P_SET:
           va = checktype(ctx, fe_nextarg(ctx, &arg), FE_TSYMBOL);
-          cdr(getbound(va, env)) = evalarg();
+          vb = getbound(va, env);
+          cdr(vb) = evalarg();
+          writebarrier(ctx, vb);
+          /* a global binding cell is the one its symbol points to */
+          if (cdr(va) == vb) { written(ctx, va); }
           break;
 
         case P_IF:
           while (!isnil(arg)) {
+            if (type(arg) == FE_TPAIR && isnil(cdr(arg))) {
+              /* else branch */
+              evaltail(car(arg), env, NULL);
+              break;
+            }
             va = evalarg();
             if (!isnil(va)) {
-              res = isnil(arg) ? va : evalarg();
+              evaltail(fe_nextarg(ctx, &arg), env, NULL);
               break;
             }
-            if (isnil(arg)) { break; }
             arg = cdr(arg);
           }
           break;
@@ -669,6 +1284,7 @@ static fe_Object* eval(fe_Context *ctx, fe_Object *obj, fe_Object *env, fe_Objec
           while (!isnil(eval(ctx, va, env, NULL))) {
             dolist(ctx, arg, env);
             fe_restoregc(ctx, n);
+            step(ctx);
           }
           break;
 
@@ -685,7 +1301,10 @@ static fe_Object* eval(fe_Context *ctx, fe_Object *obj, fe_Object *env, fe_Objec
           break;
 
         case P_DO:
-          res = dolist(ctx, arg, env);
+          va = env;
+          vb = lastform(ctx, arg, &va);
+          scratch = va;
+          evaltail(vb, va, &scratch);
           break;
 
         case P_CONS:
@@ -704,11 +1323,15 @@ static fe_Object* eval(fe_Context *ctx, fe_Object *obj, fe_Object *env, fe_Objec
         case P_SETCAR:
           va = checktype(ctx, evalarg(), FE_TPAIR);
           car(va) = evalarg();
+          writebarrier(ctx, va);
+          written(ctx, va);
           break;
 
         case P_SETCDR:
           va = checktype(ctx, evalarg(), FE_TPAIR);
           cdr(va) = evalarg();
+          writebarrier(ctx, va);
+          written(ctx, va);
           break;
 
         case P_LIST:
@@ -752,18 +1375,38 @@ static fe_Object* eval(fe_Context *ctx, fe_Object *obj, fe_Object *env, fe_Objec
     case FE_TFUNC:
       arg = evallist(ctx, arg, env);
       va = cdr(fn); /* (env params ...) */
-      vb = cdr(va); /* (params ...) */
-      res = dolist(ctx, cdr(vb), argstoenv(ctx, car(vb), arg, car(va)));
+      vb = compiledcode(ctx, fn);
+      if (proto(vb)) {
+        for (n = 0; !isnil(arg); arg = cdr(arg), n++) { fe_pushgc(ctx, car(arg)); }
+        res = execute(ctx, vb, n);
+        break;
+      }
+      vb = closureparams(va); /* (params ...) */
+      va = argstoenv(ctx, car(vb), arg, car(va));
+      vb = lastform(ctx, cdr(vb), &va);
+      /* a trailing let still evaluates its value, the binding is dropped */
+      scratch = va;
+      evaltail(vb, va, &scratch);
       break;
 
     case FE_TMACRO:
       va = cdr(fn); /* (env params ...) */
-      vb = cdr(va); /* (params ...) */
+      vb = closureparams(va); /* (params ...) */
       /* replace caller object with code generated by macro and re-eval */
-      *obj = *dolist(ctx, cdr(vb), argstoenv(ctx, car(vb), arg, car(va)));
-      fe_restoregc(ctx, gc);
-      ctx->calllist = cdr(&cl);
-      return eval(ctx, obj, env, NULL);
+      vb = dolist(ctx, cdr(vb), argstoenv(ctx, car(vb), arg, car(va)));
+      if (type(vb) == FE_TPAIR || type(vb) == FE_TSYMBOL) {
+        *obj = *vb;
+      } else {
+        /* an immediate has no cell to copy, and a copied string, ptr or
+        ** code cell would be freed twice; quote the value instead */
+        va = fe_symbol(ctx, "quote");
+        vb = fe_cons(ctx, vb, &nil);
+        car(obj) = va;
+        cdr(obj) = vb;
+      }
+      writebarrier(ctx, obj);
+      evaltail(obj, env, NULL);
+      break;
 
     default:
       fe_error(ctx, "tried to call non-callable value");
@@ -772,6 +1415,686 @@ static fe_Object* eval(fe_Context *ctx, fe_Object *obj, fe_Object *env, fe_Objec
   fe_restoregc(ctx, gc);
   fe_pushgc(ctx, res);
   ctx->calllist = cdr(&cl);
+  ctx->eval_depth--;
+  return res;
+}
+
+
+/*
+** closure compiler: turns the body of a closure into register based
+** bytecode. Parameters and `let` locals live in registers, every other
+** symbol is resolved once to its binding in the captured environment or
+** the global binding, and primitives named in head position are inlined.
+** A variable reference therefore costs a register or binding access instead
+** of an environment walk. Closures created by compiled code capture the
+** registers in scope as a fresh environment. Calls between compiled closures
+** run on an explicit frame stack, and calls in tail position reuse the
+** caller's frame. Anything outside that subset (macros, `print`, locals
+** assigned while captured, ...) makes the compiler give up and the closure
+** stays with the interpreter.
+*/
+
+enum {
+  OP_MOVE, OP_LOADK, OP_LOADNIL, OP_GETB, OP_SETB, OP_JMP, OP_JMPF, OP_JMPT,
+  OP_NUM, OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_LT, OP_LTE, OP_NOT, OP_IS,
+  OP_ATOM, OP_CONS, OP_CAR, OP_CDR, OP_SETCAR, OP_SETCDR, OP_LIST, OP_BIND,
+  OP_FN, OP_MAC, OP_CALL, OP_TAILCALL, OP_RET
+};
+
+#define MAXREGS       ( 250 )
+#define MAXCONSTS     ( 0xffff )
+
+#define ins_op(i)     ( (i) & 0xff )
+#define ins_a(i)      ( ((i) >> 8) & 0xff )
+#define ins_b(i)      ( ((i) >> 16) & 0xff )
+#define ins_c(i)      ( (i) >> 24 )
+#define ins_bx(i)     ( (i) >> 16 )
+#define mkabc(o,a,b,c) ( (unsigned) (o) | (a) << 8 | (b) << 16 | (unsigned) (c) << 24 )
+#define mkabx(o,a,bx)  ( (unsigned) (o) | (a) << 8 | (unsigned) (bx) << 16 )
+
+typedef struct {
+  fe_Object *env, *form;
+  unsigned *code;
+  fe_Object **src;
+  int ncode, capcode;
+  fe_Object **k;
+  int nk, capk;
+  fe_Object *scopesym[MAXREGS];
+  int scopereg[MAXREGS];
+  int nscope, nreg, maxreg, failed, closures, setlocal, tail;
+} Compiler;
+
+
+static int emit(Compiler *c, unsigned ins) {
+  /* every instruction remembers the form it came from for tracebacks */
+  if (c->failed) { return 0; }
+  if (c->ncode == c->capcode) {
+    unsigned *code;
+    fe_Object **src;
+    c->capcode = c->capcode ? c->capcode * 2 : 64;
+    code = realloc(c->code, c->capcode * sizeof(unsigned));
+    if (code) { c->code = code; }
+    src = realloc(c->src, c->capcode * sizeof(fe_Object*));
+    if (src) { c->src = src; }
+    if (!code || !src) { c->failed = 1; return 0; }
+  }
+  c->code[c->ncode] = ins;
+  c->src[c->ncode] = c->form;
+  return c->ncode++;
+}
+
+
+static void patch(Compiler *c, int at) {
+  /* point the jump at `at` to the next instruction */
+  if (c->ncode > 0xffff) { c->failed = 1; return; }
+  if (!c->failed) { c->code[at] |= (unsigned) c->ncode << 16; }
+}
+
+
+static int constant(Compiler *c, fe_Object *obj) {
+  int i;
+  for (i = 0; i < c->nk; i++) {
+    if (c->k[i] == obj) { return i; }
+  }
+  if (c->nk == c->capk) {
+    fe_Object **k;
+    c->capk = c->capk ? c->capk * 2 : 16;
+    k = c->capk <= MAXCONSTS ? realloc(c->k, c->capk * sizeof(fe_Object*)) : NULL;
+    if (!k) { c->failed = 1; c->nk = 0; return 0; }
+    c->k = k;
+  }
+  c->k[c->nk] = obj;
+  return c->nk++;
+}
+
+
+static int reg(Compiler *c) {
+  if (c->nreg == MAXREGS) { c->failed = 1; return 0; }
+  if (++c->nreg > c->maxreg) { c->maxreg = c->nreg; }
+  return c->nreg - 1;
+}
+
+
+static int local(Compiler *c, fe_Object *sym) {
+  int i;
+  for (i = c->nscope - 1; i >= 0; i--) {
+    if (c->scopesym[i] == sym) { return c->scopereg[i]; }
+  }
+  return -1;
+}
+
+
+static void declare(Compiler *c, fe_Object *sym, int r) {
+  if (c->nscope == MAXREGS) { c->failed = 1; return; }
+  c->scopesym[c->nscope] = sym;
+  c->scopereg[c->nscope++] = r;
+}
+
+
+static int listlength(Compiler *c, fe_Object *lst) {
+  int n = 0;
+  for (; type(lst) == FE_TPAIR; lst = cdr(lst)) { n++; }
+  if (!isnil(lst)) { c->failed = 1; }
+  return n;
+}
+
+
+static fe_Object* headvalue(Compiler *c, fe_Object *head) {
+  /* current value of a global or captured symbol in head position */
+  if (type(head) != FE_TSYMBOL || local(c, head) >= 0) { return NULL; }
+  return cdr(getbound(head, c->env));
+}
+
+
+static int assigns(Compiler *c, fe_Object *x, int depth) {
+  /* does x possibly contain (= sym ...) for a register local sym */
+  fe_Object *v;
+  if (depth > 64) { return 1; }
+  for (; type(x) == FE_TPAIR; x = cdr(x)) {
+    v = headvalue(c, car(x));
+    if (v && type(v) == FE_TPRIM && prim(v) == P_SET &&
+        type(cdr(x)) == FE_TPAIR && local(c, car(cdr(x))) >= 0) {
+      return 1;
+    }
+    if (assigns(c, car(x), depth + 1)) { return 1; }
+  }
+  return 0;
+}
+
+
+static void compexpr(Compiler *c, fe_Object *x, int dst);
+
+static void compbody(Compiler *c, fe_Object *body, int dst, int tail) {
+  int nscope = c->nscope, nreg = c->nreg;
+  fe_Object *v;
+  if (isnil(body)) { emit(c, mkabc(OP_LOADNIL, dst, 0, 0)); }
+  for (; type(body) == FE_TPAIR && !c->failed; body = cdr(body)) {
+    fe_Object *x = car(body);
+    if (type(x) == FE_TPAIR && (v = headvalue(c, car(x))) &&
+        type(v) == FE_TPRIM && prim(v) == P_LET) {
+      /* (let sym val) binds sym for the rest of the body */
+      int r;
+      if (listlength(c, cdr(x)) < 2 || type(car(cdr(x))) != FE_TSYMBOL) {
+        c->failed = 1;
+        break;
+      }
+      r = reg(c);
+      compexpr(c, car(cdr(cdr(x))), r);
+      declare(c, car(cdr(x)), r);
+      if (isnil(cdr(body))) { emit(c, mkabc(OP_LOADNIL, dst, 0, 0)); }
+    } else {
+      c->tail = tail && isnil(cdr(body));
+      compexpr(c, x, dst);
+    }
+  }
+  if (!isnil(body)) { c->failed = 1; }
+  c->nscope = nscope;
+  c->nreg = nreg;
+}
+
+
+static void compargs(Compiler *c, fe_Object *args, int first, int n) {
+  /* compile n arguments into consecutive registers starting at first */
+  int i;
+  for (i = 0; i < n; i++, args = cdr(args)) {
+    compexpr(c, car(args), first + i);
+  }
+}
+
+
+static void compprim(Compiler *c, int p, fe_Object *args, int dst, int tail) {
+  int n = listlength(c, args), i, r, at, end[MAXREGS];
+  int nreg = c->nreg;
+  fe_Object *v;
+  if (n >= MAXREGS) { c->failed = 1; return; }
+
+  switch (p) {
+    case P_LET:
+      /* let outside of a body binds nothing and evaluates nothing */
+      if (n < 1 || type(car(args)) != FE_TSYMBOL) { c->failed = 1; }
+      emit(c, mkabc(OP_LOADNIL, dst, 0, 0));
+      break;
+
+    case P_SET:
+      if (n < 2 || type(car(args)) != FE_TSYMBOL) { c->failed = 1; break; }
+      v = car(args);
+      r = reg(c);
+      compexpr(c, car(cdr(args)), r);
+      if (local(c, v) >= 0) {
+        emit(c, mkabc(OP_MOVE, local(c, v), r, 0));
+        c->setlocal = 1;
+      } else {
+        emit(c, mkabx(OP_SETB, r, constant(c, getbound(v, c->env))));
+      }
+      emit(c, mkabc(OP_LOADNIL, dst, 0, 0));
+      break;
+
+    case P_IF:
+      for (i = 0; n > 0 && !c->failed; n -= 2, args = cdr(args)) {
+        c->tail = tail && n == 1;
+        compexpr(c, car(args), dst);
+        if (n == 1) { break; }
+        args = cdr(args);
+        at = emit(c, mkabc(OP_JMPF, dst, 0, 0));
+        c->tail = tail;
+        compexpr(c, car(args), dst);
+        end[i++] = emit(c, mkabc(OP_JMP, 0, 0, 0));
+        patch(c, at);
+        if (n == 2) { emit(c, mkabc(OP_LOADNIL, dst, 0, 0)); }
+      }
+      if (i == 0 && n <= 0) { emit(c, mkabc(OP_LOADNIL, dst, 0, 0)); }
+      while (i--) { patch(c, end[i]); }
+      break;
+
+    case P_WHILE:
+      if (n < 1) { c->failed = 1; break; }
+      r = reg(c);
+      i = c->ncode;
+      compexpr(c, car(args), r);
+      at = emit(c, mkabc(OP_JMPF, r, 0, 0));
+      compbody(c, cdr(args), r, 0);
+      emit(c, mkabx(OP_JMP, 0, i));
+      patch(c, at);
+      emit(c, mkabc(OP_LOADNIL, dst, 0, 0));
+      break;
+
+    case P_QUOTE:
+      if (n < 1) { c->failed = 1; break; }
+      emit(c, mkabx(OP_LOADK, dst, constant(c, car(args))));
+      break;
+
+    case P_AND: case P_OR:
+      if (n == 0) { emit(c, mkabc(OP_LOADNIL, dst, 0, 0)); }
+      for (i = 0; n > 0 && !c->failed; n--, args = cdr(args)) {
+        compexpr(c, car(args), dst);
+        if (n > 1) { end[i++] = emit(c, mkabc(p == P_AND ? OP_JMPF : OP_JMPT, dst, 0, 0)); }
+      }
+      while (i--) { patch(c, end[i]); }
+      break;
+
+    case P_DO:
+      compbody(c, args, dst, tail);
+      break;
+
+    case P_FN: case P_MAC:
+      /* the new closure sees the registers in scope as an environment of
+      ** copies, so none of them may ever be assigned */
+      if (n < 1 || assigns(c, args, 0)) { c->failed = 1; break; }
+      c->closures = 1;
+      emit(c, mkabx(OP_LOADK, dst, constant(c, c->env)));
+      for (i = 0; i < c->nscope; i++) {
+        r = constant(c, c->scopesym[i]);
+        if (r > 0xff) { c->failed = 1; }
+        emit(c, mkabc(OP_BIND, dst, c->scopereg[i], r));
+      }
+      emit(c, mkabx(p == P_FN ? OP_FN : OP_MAC, dst, constant(c, args)));
+      break;
+
+    case P_CONS: case P_IS: case P_LT: case P_LTE:
+    case P_SETCAR: case P_SETCDR:
+      if (n < 2) { c->failed = 1; break; }
+      r = reg(c);
+      compexpr(c, car(args), dst);
+      compexpr(c, car(cdr(args)), r);
+      switch (p) {
+        case P_CONS: emit(c, mkabc(OP_CONS, dst, dst, r)); break;
+        case P_IS: emit(c, mkabc(OP_IS, dst, dst, r)); break;
+        case P_LT: emit(c, mkabc(OP_LT, dst, dst, r)); break;
+        case P_LTE: emit(c, mkabc(OP_LTE, dst, dst, r)); break;
+        default:
+          emit(c, mkabc(p == P_SETCAR ? OP_SETCAR : OP_SETCDR, dst, r, 0));
+          emit(c, mkabc(OP_LOADNIL, dst, 0, 0));
+          break;
+      }
+      break;
+
+    case P_CAR: case P_CDR: case P_NOT: case P_ATOM:
+      if (n < 1) { c->failed = 1; break; }
+      compexpr(c, car(args), dst);
+      emit(c, mkabc(p == P_CAR ? OP_CAR : p == P_CDR ? OP_CDR :
+                    p == P_NOT ? OP_NOT : OP_ATOM, dst, dst, 0));
+      break;
+
+    case P_LIST:
+      if (n == 0) { emit(c, mkabc(OP_LOADNIL, dst, 0, 0)); break; }
+      r = c->nreg;
+      for (i = 0; i < n; i++) { reg(c); }
+      if (c->failed) { break; }
+      compargs(c, args, r, n);
+      emit(c, mkabc(OP_LIST, dst, r, n));
+      break;
+
+    case P_ADD: case P_SUB: case P_MUL: case P_DIV:
+      /* OP_NUM checks the first operand, the rest accumulate onto it */
+      if (n < 1) { c->failed = 1; break; }
+      compexpr(c, car(args), dst);
+      emit(c, mkabc(OP_NUM, dst, dst, 0));
+      r = reg(c);
+      for (args = cdr(args); !isnil(args) && !c->failed; args = cdr(args)) {
+        compexpr(c, car(args), r);
+        emit(c, mkabc(OP_ADD + (p - P_ADD), dst, r, 0));
+      }
+      break;
+
+    default:
+      c->failed = 1;
+      break;
+  }
+  c->nreg = nreg;
+}
+
+
+static void compexpr(Compiler *c, fe_Object *x, int dst) {
+  /* c->tail is set by the caller for an expression whose value is returned */
+  fe_Object *v, *form = c->form;
+  int n, r, nreg = c->nreg, tail = c->tail;
+  c->tail = 0;
+  if (c->failed) { return; }
+  if (type(x) == FE_TPAIR) { c->form = x; }
+
+  switch (type(x)) {
+    case FE_TNIL:
+      emit(c, mkabc(OP_LOADNIL, dst, 0, 0));
+      break;
+
+    case FE_TSYMBOL:
+      r = local(c, x);
+      if (r >= 0) {
+        emit(c, mkabc(OP_MOVE, dst, r, 0));
+      } else {
+        emit(c, mkabx(OP_GETB, dst, constant(c, getbound(x, c->env))));
+      }
+      break;
+
+    case FE_TPAIR:
+      v = headvalue(c, car(x));
+      if (v && type(v) == FE_TPRIM) {
+        compprim(c, prim(v), cdr(x), dst, tail);
+        break;
+      }
+      if (v && type(v) == FE_TMACRO) { c->failed = 1; break; }
+      /* generic call: callee and arguments in consecutive registers */
+      n = listlength(c, cdr(x));
+      r = c->nreg;
+      for (v = x; type(v) == FE_TPAIR; v = cdr(v)) { reg(c); }
+      if (c->failed) { break; }
+      compexpr(c, car(x), r);
+      compargs(c, cdr(x), r + 1, n);
+      emit(c, mkabc(tail ? OP_TAILCALL : OP_CALL, dst, r, n));
+      c->nreg = nreg;
+      break;
+
+    default:
+      emit(c, mkabx(OP_LOADK, dst, constant(c, x)));
+      break;
+  }
+  c->form = form;
+}
+
+
+static Proto* compile(fe_Object *env, fe_Object *prm, fe_Object *body) {
+  Compiler c;
+  Proto *p = NULL;
+  int nparams = 0, rest = 0, r;
+  memset(&c, 0, sizeof(c));
+  c.env = env;
+  c.form = &nil;
+  /* parameters occupy the first registers, a rest parameter follows */
+  for (; type(prm) == FE_TPAIR; prm = cdr(prm)) {
+    if (type(car(prm)) != FE_TSYMBOL) { c.failed = 1; }
+    declare(&c, car(prm), reg(&c));
+    nparams++;
+  }
+  if (!isnil(prm)) {
+    if (type(prm) != FE_TSYMBOL) { c.failed = 1; }
+    declare(&c, prm, reg(&c));
+    rest = 1;
+  }
+  r = reg(&c);
+  compbody(&c, body, r, 1);
+  emit(&c, mkabc(OP_RET, r, 0, 0));
+
+  if (c.closures && c.setlocal) { c.failed = 1; }
+  if (!c.failed && c.ncode <= 0xffff) {
+    p = malloc(sizeof(Proto) + (c.nk + c.ncode) * sizeof(fe_Object*) + c.ncode * sizeof(unsigned));
+  }
+  if (p) {
+    p->k = (fe_Object**) (p + 1);
+    p->src = p->k + c.nk;
+    p->code = (unsigned*) (p->src + c.ncode);
+    p->nk = c.nk;
+    p->ncode = c.ncode;
+    p->nparams = nparams;
+    p->rest = rest;
+    p->nregs = c.maxreg;
+    if (c.nk) { memcpy(p->k, c.k, c.nk * sizeof(fe_Object*)); }
+    memcpy(p->src, c.src, c.ncode * sizeof(fe_Object*));
+    memcpy(p->code, c.code, c.ncode * sizeof(unsigned));
+  }
+  free(c.code);
+  free(c.src);
+  free(c.k);
+  return p;
+}
+
+
+static fe_Object* compiledcode(fe_Context *ctx, fe_Object *fn) {
+  /* returns the cached code object of the closure, compiling it on first
+  ** call; its proto is NULL if the closure could not be compiled */
+  fe_Object *va = cdr(fn), *vb = cdr(va), *code = closurecode(va);
+  if (code) { return code; }
+  code = object(ctx);
+  settype(code, FE_TCODE);
+  cdr(code) = NULL;
+  cdr(code) = (fe_Object*) compile(car(va), car(vb), cdr(vb));
+  cdr(va) = fe_cons(ctx, code, vb);
+  writebarrier(ctx, va);
+  return code;
+}
+
+
+static fe_Object* apply(fe_Context *ctx, fe_Object *fn, int argc) {
+  /* calls fn with the argc values on top of the gcstack */
+  int base = ctx->gcstack_idx - argc, i;
+  fe_Object *arg, *code, *res;
+  if (type(fn) == FE_TFUNC) {
+    code = compiledcode(ctx, fn);
+    ctx->gcstack_idx = base + argc;
+    if (proto(code)) { return execute(ctx, code, argc); }
+  }
+  arg = &nil;
+  for (i = argc - 1; i >= 0; i--) {
+    arg = fe_cons(ctx, ctx->gcstack[base + i], arg);
+  }
+  switch (type(fn)) {
+    case FE_TFUNC:
+      code = closureparams(cdr(fn));
+      res = dolist(ctx, cdr(code), argstoenv(ctx, car(code), arg, car(cdr(fn))));
+      break;
+
+    case FE_TCFUNC:
+      res = cfunc(fn)(ctx, arg);
+      break;
+
+    default:
+      /* evaluate (fn 'arg ...) for anything else */
+      code = fe_symbol(ctx, "quote");
+      for (res = &nil, i = argc - 1; i >= 0; i--) {
+        arg = fe_cons(ctx, code, fe_cons(ctx, ctx->gcstack[base + i], &nil));
+        res = fe_cons(ctx, arg, res);
+      }
+      res = eval(ctx, fe_cons(ctx, fn, res), &nil, NULL);
+      break;
+  }
+  ctx->gcstack_idx = base;
+  return res;
+}
+
+
+#define R(i)          ( ctx->gcstack[base + (i)] )
+
+#define vmarith(op) {                                                 \
+    fe_Number n = number(R(ins_a(ins)));                              \
+    x = fe_number(ctx, n op fe_tonumber(ctx, R(ins_b(ins))));         \
+    R(ins_a(ins)) = x;                                                \
+  }
+
+static Frame* pushframe(fe_Context *ctx) {
+  FrameBlock *b = ctx->frames;
+  if (ctx->frame_depth == GCSTACKMAX) { fe_error(ctx, "call stack overflow"); }
+  if (!b || ctx->frame_idx == FRAMEBLOCK) {
+    if (!b || !b->next) {
+      FrameBlock *nb = malloc(sizeof(FrameBlock));
+      if (!nb) { fe_error(ctx, "call stack overflow"); }
+      nb->prev = b, nb->next = NULL;
+      if (b) { b->next = nb; }
+      b = nb;
+    } else {
+      b = b->next;
+    }
+    ctx->frames = b;
+    ctx->frame_idx = 0;
+  }
+  ctx->frame_depth++;
+  return &b->frames[ctx->frame_idx++];
+}
+
+
+static Frame* popframe(fe_Context *ctx) {
+  /* drops the current frame and returns the one below it */
+  ctx->frame_depth--;
+  if (--ctx->frame_idx == 0 && ctx->frames->prev) {
+    ctx->frames = ctx->frames->prev;
+    ctx->frame_idx = FRAMEBLOCK;
+  }
+  return ctx->frame_idx ? &ctx->frames->frames[ctx->frame_idx - 1] : NULL;
+}
+
+
+static void enter(fe_Context *ctx, Frame *f, fe_Object *code, int argc) {
+  /* turns the argc values on top of the gcstack into the registers of a
+  ** call to code; the slot above the registers keeps code alive */
+  Proto *p = proto(code);
+  int base = ctx->gcstack_idx - argc, i;
+  fe_Object *x = &nil;
+
+  while (base + p->nregs + 1 > ctx->gcstack_size) { growgcstack(ctx); }
+  if (p->rest) {
+    fe_pushgc(ctx, code);
+    for (i = argc - 1; i >= p->nparams; i--) {
+      x = fe_cons(ctx, R(i), x);
+    }
+  }
+  ctx->gcstack_idx = base + (argc < p->nparams ? argc : p->nparams);
+  while (ctx->gcstack_idx < base + p->nparams) { ctx->gcstack[ctx->gcstack_idx++] = &nil; }
+  if (p->rest) { ctx->gcstack[ctx->gcstack_idx++] = x; }
+  while (ctx->gcstack_idx < base + p->nregs) { ctx->gcstack[ctx->gcstack_idx++] = &nil; }
+  ctx->gcstack[ctx->gcstack_idx++] = code;
+  f->code = code;
+  f->pc = p->code;
+  f->base = base;
+}
+
+
+#define loadframe() (                                                 \
+    p = proto(f->code), pc = f->pc,                                   \
+    base = f->base, top = base + p->nregs + 1 )
+
+static fe_Object* execute(fe_Context *ctx, fe_Object *code, int argc) {
+  /* runs compiled code with the argc values on top of the gcstack as
+  ** arguments. Calls between compiled closures push a Frame instead of
+  ** recursing, calls in tail position replace the current one */
+  Frame *f = pushframe(ctx);
+  int depth = ctx->frame_depth, base, top, i, n;
+  const unsigned *pc;
+  fe_Object *x, *y;
+  Proto *p;
+
+  car(&f->cl) = &nil, cdr(&f->cl) = ctx->calllist;
+  ctx->calllist = &f->cl;
+  enter(ctx, f, code, argc);
+  loadframe();
+
+  for (;;) {
+    unsigned ins;
+    car(&f->cl) = p->src[pc - p->code];
+    ins = *pc++;
+    /* anything allocated by the last instruction is held by a register */
+    ctx->gcstack_idx = top;
+    switch (ins_op(ins)) {
+      case OP_MOVE: R(ins_a(ins)) = R(ins_b(ins)); break;
+      case OP_LOADK: R(ins_a(ins)) = p->k[ins_bx(ins)]; break;
+      case OP_LOADNIL: R(ins_a(ins)) = &nil; break;
+      case OP_GETB: R(ins_a(ins)) = cdr(p->k[ins_bx(ins)]); break;
+      case OP_SETB:
+        x = p->k[ins_bx(ins)];
+        cdr(x) = R(ins_a(ins));
+        writebarrier(ctx, x);
+        if (ctx->handlers.write && type(car(x)) == FE_TSTRING) {
+          written(ctx, bindingsymbol(ctx, x));
+        }
+        break;
+      case OP_JMP: step(ctx); pc = p->code + ins_bx(ins); break;
+      case OP_JMPF: if (isnil(R(ins_a(ins)))) { pc = p->code + ins_bx(ins); } break;
+      case OP_JMPT: if (!isnil(R(ins_a(ins)))) { pc = p->code + ins_bx(ins); } break;
+      case OP_NUM:
+        x = fe_number(ctx, fe_tonumber(ctx, R(ins_b(ins))));
+        R(ins_a(ins)) = x;
+        break;
+      case OP_ADD: vmarith(+); break;
+      case OP_SUB: vmarith(-); break;
+      case OP_MUL: vmarith(*); break;
+      case OP_DIV: vmarith(/); break;
+      case OP_LT: case OP_LTE:
+        x = checktype(ctx, R(ins_b(ins)), FE_TNUMBER);
+        y = checktype(ctx, R(ins_c(ins)), FE_TNUMBER);
+        R(ins_a(ins)) = fe_bool(ctx, ins_op(ins) == OP_LT ?
+                                number(x) < number(y) : number(x) <= number(y));
+        break;
+      case OP_NOT: R(ins_a(ins)) = fe_bool(ctx, isnil(R(ins_b(ins)))); break;
+      case OP_IS: R(ins_a(ins)) = fe_bool(ctx, equal(R(ins_b(ins)), R(ins_c(ins)))); break;
+      case OP_ATOM: R(ins_a(ins)) = fe_bool(ctx, type(R(ins_b(ins))) != FE_TPAIR); break;
+      case OP_CONS:
+        x = fe_cons(ctx, R(ins_b(ins)), R(ins_c(ins)));
+        R(ins_a(ins)) = x;
+        break;
+      case OP_CAR: R(ins_a(ins)) = fe_car(ctx, R(ins_b(ins))); break;
+      case OP_CDR: R(ins_a(ins)) = fe_cdr(ctx, R(ins_b(ins))); break;
+      case OP_SETCAR: case OP_SETCDR:
+        x = checktype(ctx, R(ins_a(ins)), FE_TPAIR);
+        if (ins_op(ins) == OP_SETCAR) { car(x) = R(ins_b(ins)); } else { cdr(x) = R(ins_b(ins)); }
+        writebarrier(ctx, x);
+        written(ctx, x);
+        break;
+      case OP_LIST:
+        x = &nil;
+        for (i = ins_c(ins) - 1; i >= 0; i--) { x = fe_cons(ctx, R(ins_b(ins) + i), x); }
+        R(ins_a(ins)) = x;
+        break;
+      case OP_BIND:
+        x = fe_cons(ctx, p->k[ins_c(ins)], R(ins_b(ins)));
+        x = fe_cons(ctx, x, R(ins_a(ins)));
+        R(ins_a(ins)) = x;
+        break;
+      case OP_FN: case OP_MAC:
+        y = fe_cons(ctx, R(ins_a(ins)), p->k[ins_bx(ins)]);
+        x = object(ctx);
+        settype(x, ins_op(ins) == OP_FN ? FE_TFUNC : FE_TMACRO);
+        cdr(x) = y;
+        R(ins_a(ins)) = x;
+        break;
+      case OP_CALL: case OP_TAILCALL:
+        x = R(ins_b(ins));
+        n = ins_c(ins);
+        code = type(x) == FE_TFUNC ? compiledcode(ctx, x) : NULL;
+        ctx->gcstack_idx = top;
+        if (!code || !proto(code)) {
+          for (i = 1; i <= n; i++) { fe_pushgc(ctx, R(ins_b(ins) + i)); }
+          x = apply(ctx, x, n);
+          R(ins_a(ins)) = x;
+          break;
+        }
+        step(ctx);
+        if (ins_op(ins) == OP_TAILCALL) {
+          /* the callee takes over this frame and its registers */
+          for (i = 0; i < n; i++) { R(i) = R(ins_b(ins) + 1 + i); }
+          ctx->gcstack_idx = base + n;
+        } else {
+          for (i = 1; i <= n; i++) { fe_pushgc(ctx, R(ins_b(ins) + i)); }
+          f->pc = pc;
+          f->ret = ins_a(ins);
+          f = pushframe(ctx);
+          car(&f->cl) = &nil, cdr(&f->cl) = ctx->calllist;
+          ctx->calllist = &f->cl;
+        }
+        enter(ctx, f, code, n);
+        loadframe();
+        break;
+      case OP_RET:
+        x = R(ins_a(ins));
+        ctx->gcstack_idx = base;
+        ctx->calllist = cdr(&f->cl);
+        if (ctx->frame_depth == depth) {
+          popframe(ctx);
+          return x;
+        }
+        f = popframe(ctx);
+        loadframe();
+        R(f->ret) = x;
+        break;
+    }
+  }
+}
+
+
+fe_Object* fe_call(fe_Context *ctx, fe_Object *fn, fe_Object **args, int n) {
+  int gc = fe_savegc(ctx), i;
+  fe_Object *res;
+  fe_pushgc(ctx, fn);
+  for (i = 0; i < n; i++) { fe_pushgc(ctx, args[i]); }
+  res = apply(ctx, fn, n);
+  fe_restoregc(ctx, gc);
+  fe_pushgc(ctx, res);
   return res;
 }
 
@@ -791,23 +2114,35 @@ fe_Context* fe_open(void *ptr, int size) {
   ptr = (char*) ptr + sizeof(fe_Context);
   size -= sizeof(fe_Context);
 
-  /* init objects memory region */
-  ctx->objects = (fe_Object*) ptr;
-  ctx->object_count = size / sizeof(fe_Object);
+  /* immediate numbers rely on objects being 8 byte aligned */
+  i = (int) ((size_t) ptr & 0x7);
+  if (i) {
+    ptr = (char*) ptr + 8 - i;
+    size -= 8 - i;
+  }
+
+  /* init gc stack */
+  ctx->gcstack = ctx->gcstack_base;
+  ctx->gcstack_size = GCSTACKSIZE;
+
+  ctx->roots_free = -1;
+
+  /* no budget until the host sets one */
+  ctx->budget.steps = -1;
+  atomic_init(&ctx->cancel, 0);
 
   /* init lists */
   ctx->calllist = &nil;
   ctx->freelist = &nil;
-  ctx->symlist = &nil;
-
-  /* populate freelist */
-  for (i = 0; i < ctx->object_count; i++) {
-    fe_Object *obj = &ctx->objects[i];
-    settype(obj, FE_TFREE);
-    cdr(obj) = ctx->freelist;
-    ctx->freelist = obj;
+  ctx->symtable = ctx->symtable_base;
+  ctx->symtable_size = SYMTABSIZE;
+  for (i = 0; i < SYMTABSIZE; i++) {
+    ctx->symtable[i] = &nil;
   }
 
+  /* init objects memory region and populate freelist */
+  addsegment(ctx, &ctx->heap, (fe_Object*) ptr, size / sizeof(fe_Object));
+
   /* init objects */
   ctx->t = fe_symbol(ctx, "t");
   fe_set(ctx, ctx->t, ctx->t);
@@ -827,10 +2162,31 @@ fe_Context* fe_open(void *ptr, int size) {
 
 
 void fe_close(fe_Context *ctx) {
-  /* clear gcstack and symlist; makes all objects unreachable */
+  int i;
+  /* clear gcstack, roots and symtable; makes all objects unreachable */
   ctx->gcstack_idx = 0;
-  ctx->symlist = &nil;
+  ctx->roots_idx = 0;
+  for (i = 0; i < ctx->symtable_size; i++) {
+    ctx->symtable[i] = &nil;
+  }
   collectgarbage(ctx);
+  freenursery(ctx);
+  /* free grown heap segments and gc stack */
+  while (ctx->heap.next) {
+    Segment *seg = ctx->heap.next;
+    ctx->heap.next = seg->next;
+    free(seg);
+  }
+  if (ctx->gcstack != ctx->gcstack_base) { free(ctx->gcstack); }
+  free(ctx->roots);
+  if (ctx->symtable != ctx->symtable_base) { free(ctx->symtable); }
+  while (ctx->frames && ctx->frames->prev) { ctx->frames = ctx->frames->prev; }
+  while (ctx->frames) {
+    FrameBlock *b = ctx->frames;
+    ctx->frames = b->next;
+    free(b);
+  }
+  free(ctx->readbuf);
 }
 
 
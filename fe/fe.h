@@ -24,7 +24,20 @@ typedef struct
 {
   fe_ErrorFn error;
   fe_CFunc mark, gc;
+  fe_CFunc write; /* called with the symbol of a written global or the written pair */
 } fe_Handlers;
+typedef struct
+{
+  int segment; /* minimum objects per grown heap segment, 0 disables growth */
+  int growth;  /* percent of the current heap size to grow by */
+  int limit;   /* maximum objects in the heap, 0 for no limit */
+  int nursery; /* young objects between minor collections, 0 for full collections only */
+} fe_HeapPolicy;
+typedef struct
+{
+  long steps; /* evaluation steps left, negative for no budget */
+  int (*poll)(fe_Context *ctx); /* non zero stops the evaluation as well */
+} fe_Budget;
 
 enum
 {
@@ -44,6 +57,10 @@ enum
 fe_Context *fe_open(void *ptr, int size);
 void fe_close(fe_Context *ctx);
 fe_Handlers *fe_handlers(fe_Context *ctx);
+fe_HeapPolicy *fe_heappolicy(fe_Context *ctx);
+fe_Budget *fe_budget(fe_Context *ctx);
+void fe_cancel(fe_Context *ctx, int cancel);
+int fe_cancelled(fe_Context *ctx);
 void fe_error(fe_Context *ctx, const char *msg);
 fe_Object *fe_nextarg(fe_Context *ctx, fe_Object **arg);
 int fe_type(fe_Context *ctx, fe_Object *obj);
@@ -51,6 +68,8 @@ int fe_isnil(fe_Context *ctx, fe_Object *obj);
 void fe_pushgc(fe_Context *ctx, fe_Object *obj);
 void fe_restoregc(fe_Context *ctx, int idx);
 int fe_savegc(fe_Context *ctx);
+int fe_addroot(fe_Context *ctx, fe_Object *obj);
+void fe_removeroot(fe_Context *ctx, int root);
 void fe_mark(fe_Context *ctx, fe_Object *obj);
 fe_Object *fe_cons(fe_Context *ctx, fe_Object *car, fe_Object *cdr);
 fe_Object *fe_bool(fe_Context *ctx, int b);
@@ -67,9 +86,20 @@ void fe_writefp(fe_Context *ctx, fe_Object *obj, FILE *fp);
 int fe_tostring(fe_Context *ctx, fe_Object *obj, char *dst, int size);
 fe_Number fe_tonumber(fe_Context *ctx, fe_Object *obj);
 void *fe_toptr(fe_Context *ctx, fe_Object *obj);
+int fe_strlen(fe_Context *ctx, fe_Object *obj);
+const char *fe_strptr(fe_Context *ctx, fe_Object *obj);
+fe_CFunc fe_tocfunc(fe_Context *ctx, fe_Object *obj);
+const char *fe_primname(fe_Context *ctx, fe_Object *obj);
+fe_Object *fe_fnparams(fe_Context *ctx, fe_Object *fn);
+fe_Object *fe_fnbody(fe_Context *ctx, fe_Object *fn);
+fe_Object *fe_fnlookup(fe_Context *ctx, fe_Object *fn, fe_Object *sym);
+fe_Object *fe_fnlocal(fe_Context *ctx, fe_Object *fn, fe_Object *sym);
 void fe_set(fe_Context *ctx, fe_Object *sym, fe_Object *v);
+fe_Object *fe_snapshot(fe_Context *ctx);
 fe_Object *fe_read(fe_Context *ctx, fe_ReadFn fn, void *udata);
+fe_Object *fe_readspan(fe_Context *ctx, const char **ptr, const char *end);
 fe_Object *fe_readfp(fe_Context *ctx, FILE *fp);
 fe_Object *fe_eval(fe_Context *ctx, fe_Object *obj);
+fe_Object *fe_call(fe_Context *ctx, fe_Object *fn, fe_Object **args, int n);
 
 #endif
@@ -0,0 +1,355 @@
+#include "feexpr.h"
+
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+extern "C"
+{
+#include "fe/fe.h"
+}
+
+static std::unordered_map<FeExpr::NativeFn, FeExpr::Op> &natives()
+{
+  static std::unordered_map<FeExpr::NativeFn, FeExpr::Op> n;
+  return n;
+}
+
+void FeExpr::define(NativeFn f, Op op)
+{
+  natives()[f] = op;
+}
+
+int FeExpr::node(Op op, int a, int b, int c, float k)
+{
+  // a failed operand fails the whole expression
+  const auto args = (op == Const || op == Time) ? 0 : op == Not ? 1 : op == If ? 3 : 2;
+  if ((args > 0 && a < 0) || (args > 1 && b < 0) || (args > 2 && c < 0))
+    return -1;
+  m_nodes.push_back({op, k, a, b, c});
+  return int(m_nodes.size()) - 1;
+}
+
+bool FeExpr::is_local(fe_Object *sym) const
+{
+  if (sym == m_param)
+    return true;
+  for (const auto &l : m_locals)
+    if (l.sym == sym)
+      return true;
+  return false;
+}
+
+bool FeExpr::is_cond(int n) const
+{
+  switch (m_nodes[n].op)
+  {
+  case Lt:
+  case Lte:
+  case Not:
+  case And:
+  case Or:
+    return true;
+  default:
+    return false;
+  }
+}
+
+int FeExpr::fold(Op op, int first, fe_Object *args)
+{
+  // (op a b c) as ((a op b) op c), the way fe and the cfuncs accumulate
+  int r = first;
+  while (r >= 0 && fe_type(m_ctx, args) == FE_TPAIR)
+  {
+    r = node(op, r, lower_expr(fe_car(m_ctx, args)));
+    args = fe_cdr(m_ctx, args);
+  }
+  return fe_isnil(m_ctx, args) ? r : -1;
+}
+
+int FeExpr::lower_call(Op op, fe_Object *args)
+{
+  if (fe_type(m_ctx, args) != FE_TPAIR)
+    return -1;
+  const auto a = lower_expr(fe_car(m_ctx, args));
+  auto rest = fe_cdr(m_ctx, args);
+
+  switch (op)
+  {
+  case Mod:
+  case Max:
+  case Min:
+    return fold(op, a, rest);
+  case FSin:
+  case FCos:
+    if (fe_isnil(m_ctx, rest))
+      return node(op, a, node(Const, -1, -1, -1, 1.0f));
+    return node(op, a, lower_expr(fe_car(m_ctx, rest)));
+  default:
+    return node(op, a, a);
+  }
+}
+
+int FeExpr::lower_prim(const char *name, fe_Object *args, bool cond)
+{
+  static const struct
+  {
+    const char *name;
+    Op op;
+  } ops[] = {{"+", Add}, {"-", Sub}, {"*", Mul}, {"/", Div}, {"<", Lt}, {"<=", Lte}, {"and", And}, {"or", Or}};
+
+  if (strcmp(name, "quote") == 0)
+  {
+    const auto x = fe_car(m_ctx, args);
+    return fe_type(m_ctx, x) == FE_TNUMBER ? lower_expr(x, cond) : -1;
+  }
+
+  if (strcmp(name, "not") == 0)
+  {
+    const auto a = lower_expr(fe_car(m_ctx, args), true);
+    return cond && a >= 0 ? node(Not, a) : -1;
+  }
+
+  if (strcmp(name, "if") == 0)
+  {
+    // (if c1 e1 c2 e2 ... else), a missing else would yield nil
+    const auto c = lower_expr(fe_car(m_ctx, args), true);
+    args = fe_cdr(m_ctx, args);
+    if (c < 0 || fe_type(m_ctx, args) != FE_TPAIR || fe_type(m_ctx, fe_cdr(m_ctx, args)) != FE_TPAIR)
+      return -1;
+    const auto e = lower_expr(fe_car(m_ctx, args), cond);
+    args = fe_cdr(m_ctx, args);
+    const auto f = fe_isnil(m_ctx, fe_cdr(m_ctx, args)) ? lower_expr(fe_car(m_ctx, args), cond)
+                                                        : lower_prim("if", args, cond);
+    if (e < 0 || f < 0 || is_cond(e) != cond || is_cond(f) != cond)
+      return -1;
+    return node(If, c, e, f);
+  }
+
+  for (const auto &o : ops)
+  {
+    if (strcmp(name, o.name) != 0)
+      continue;
+    const bool logic = o.op == And || o.op == Or;
+    if ((o.op == Lt || o.op == Lte || logic) != cond || fe_type(m_ctx, args) != FE_TPAIR)
+      return -1;
+    const auto a = lower_expr(fe_car(m_ctx, args), logic);
+    if (a < 0 || is_cond(a) != logic)
+      return -1;
+    args = fe_cdr(m_ctx, args);
+    if (o.op == Lt || o.op == Lte)
+      return fe_type(m_ctx, args) == FE_TPAIR ? node(o.op, a, lower_expr(fe_car(m_ctx, args))) : -1;
+    if (!logic)
+      return fold(o.op, a, args);
+
+    auto r = a;
+    for (; r >= 0 && fe_type(m_ctx, args) == FE_TPAIR; args = fe_cdr(m_ctx, args))
+    {
+      const auto b = lower_expr(fe_car(m_ctx, args), true);
+      r = b >= 0 ? node(o.op, r, b) : -1;
+    }
+    return r;
+  }
+  return -1;
+}
+
+int FeExpr::lower_expr(fe_Object *x, bool cond)
+{
+  switch (fe_type(m_ctx, x))
+  {
+  case FE_TNUMBER:
+    return cond ? -1 : node(Const, -1, -1, -1, fe_tonumber(m_ctx, x));
+
+  case FE_TSYMBOL:
+    if (cond)
+      return -1;
+    for (auto it = m_locals.rbegin(); it != m_locals.rend(); ++it)
+      if (it->sym == x)
+        return it->node;
+    if (x == m_param)
+      return node(Time);
+    // a global may be reassigned by a later form, only captured numbers are kept
+    x = fe_fnlocal(m_ctx, m_fn, x);
+    return x && fe_type(m_ctx, x) == FE_TNUMBER ? lower_expr(x, cond) : -1;
+
+  case FE_TPAIR:
+  {
+    auto head = fe_car(m_ctx, x);
+    if (fe_type(m_ctx, head) != FE_TSYMBOL || is_local(head))
+      return -1;
+
+    head = fe_fnlookup(m_ctx, m_fn, head);
+    if (fe_type(m_ctx, head) == FE_TPRIM)
+      return lower_prim(fe_primname(m_ctx, head), fe_cdr(m_ctx, x), cond);
+    if (cond || fe_type(m_ctx, head) != FE_TCFUNC)
+      return -1;
+
+    const auto it = natives().find(fe_tocfunc(m_ctx, head));
+    if (it == natives().end() || it->second == Vec3)
+      return -1;
+    return lower_call(it->second, fe_cdr(m_ctx, x));
+  }
+
+  default:
+    return -1;
+  }
+}
+
+int FeExpr::lower_body(fe_Object *body)
+{
+  int r = -1;
+  for (; fe_type(m_ctx, body) == FE_TPAIR; body = fe_cdr(m_ctx, body))
+  {
+    auto x = fe_car(m_ctx, body);
+    auto head = fe_type(m_ctx, x) == FE_TPAIR ? fe_car(m_ctx, x) : nullptr;
+    if (head && fe_type(m_ctx, head) == FE_TSYMBOL && !is_local(head))
+      head = fe_fnlookup(m_ctx, m_fn, head);
+    const auto native = head && fe_type(m_ctx, head) == FE_TCFUNC ? natives().find(fe_tocfunc(m_ctx, head))
+                                                                  : natives().end();
+
+    if (head && fe_type(m_ctx, head) == FE_TPRIM && strcmp(fe_primname(m_ctx, head), "let") == 0)
+    {
+      // (let sym val) as the last form would yield nil
+      auto args = fe_cdr(m_ctx, x);
+      auto sym = fe_car(m_ctx, args);
+      r = fe_type(m_ctx, sym) == FE_TSYMBOL ? lower_expr(fe_car(m_ctx, fe_cdr(m_ctx, args))) : -1;
+      if (r < 0 || fe_isnil(m_ctx, fe_cdr(m_ctx, body)))
+        return -1;
+      m_locals.push_back({sym, r});
+    }
+    else if (m_size == 3 && fe_isnil(m_ctx, fe_cdr(m_ctx, body)) && native != natives().end() &&
+             native->second == Vec3)
+    {
+      // (vec3 x) or (vec3 x y z) as the result of a vec3 valued closure
+      auto args = fe_cdr(m_ctx, x);
+      for (int i = 0; i < 3 && fe_type(m_ctx, args) == FE_TPAIR; ++i, args = fe_cdr(m_ctx, args))
+        m_roots.push_back(lower_expr(fe_car(m_ctx, args)));
+      if (m_roots.size() == 1)
+        m_roots.resize(3, m_roots[0]);
+      for (const auto n : m_roots)
+        if (n < 0 || is_cond(n))
+          return -1;
+      return m_roots.size() == 3 ? m_roots[0] : -1;
+    }
+    else if ((r = lower_expr(x)) < 0)
+    {
+      return -1;
+    }
+  }
+  if (!fe_isnil(m_ctx, body) || r < 0 || is_cond(r))
+    return -1;
+  return r;
+}
+
+bool FeExpr::lower(fe_Context *ctx, fe_Object *fn, int size)
+{
+  m_ctx = ctx;
+  m_fn = fn;
+  m_param = nullptr;
+  m_locals.clear();
+  m_nodes.clear();
+  m_roots.clear();
+  m_size = size;
+
+  if (fe_type(ctx, fn) != FE_TFUNC)
+    return false;
+
+  // closures are called with a single time argument
+  auto params = fe_fnparams(ctx, fn);
+  if (fe_type(ctx, params) == FE_TPAIR)
+  {
+    m_param = fe_car(ctx, params);
+    if (fe_type(ctx, m_param) != FE_TSYMBOL || !fe_isnil(ctx, fe_cdr(ctx, params)))
+      return false;
+  }
+  else if (!fe_isnil(ctx, params))
+  {
+    return false;
+  }
+
+  const auto r = lower_body(fe_fnbody(ctx, fn));
+  if (r < 0)
+    return false;
+  if (m_roots.empty())
+    m_roots.push_back(r);
+  if (int(m_roots.size()) != size)
+    return false;
+
+  m_values.resize(m_nodes.size());
+  m_ctx = nullptr;
+  m_fn = nullptr;
+  m_locals.clear();
+  return true;
+}
+
+bool FeExpr::constant() const
+{
+  // operands always come before the node using them
+  std::vector<bool> used(m_nodes.size());
+  for (const auto r : m_roots)
+    used[r] = true;
+  for (auto i = m_nodes.size(); i-- > 0;)
+  {
+    if (!used[i])
+      continue;
+    const auto &n = m_nodes[i];
+    if (n.op == Time)
+      return false;
+    for (const auto o : {n.a, n.b, n.c})
+      if (o >= 0)
+        used[o] = true;
+  }
+  return true;
+}
+
+void FeExpr::eval(float t, float *out) const
+{
+  auto *v = m_values.data();
+  for (size_t i = 0; i < m_nodes.size(); ++i)
+  {
+    const auto &n = m_nodes[i];
+    const auto a = n.a < 0 ? 0.0f : v[n.a];
+    const auto b = n.b < 0 ? 0.0f : v[n.b];
+    switch (n.op)
+    {
+    case Const: v[i] = n.k; break;
+    case Time: v[i] = t; break;
+    case Add: v[i] = a + b; break;
+    case Sub: v[i] = a - b; break;
+    case Mul: v[i] = a * b; break;
+    case Div: v[i] = a / b; break;
+    case Lt: v[i] = a < b; break;
+    case Lte: v[i] = a <= b; break;
+    case Not: v[i] = a == 0.0f; break;
+    case And: v[i] = a != 0.0f && b != 0.0f; break;
+    case Or: v[i] = a != 0.0f || b != 0.0f; break;
+    case If: v[i] = a != 0.0f ? b : v[n.c]; break;
+    case Mod: v[i] = a - std::floor(a / b) * b; break;
+    case Max: v[i] = (a < b) ? b : a; break;
+    case Min: v[i] = (a < b) ? a : b; break;
+    case Rad: v[i] = float(M_PI * (a / 180.0)); break;
+    case Deg: v[i] = float(180.0 * (a / M_PI)); break;
+    case FSin: v[i] = float(std::sin(double(b) * 2.0 * a * M_PI)); break;
+    case FCos: v[i] = float(std::cos(double(b) * 2.0 * a * M_PI)); break;
+    case Floor: v[i] = std::floor(a); break;
+    case Ceil: v[i] = std::ceil(a); break;
+    case Abs: v[i] = std::abs(a); break;
+    case Sqrt: v[i] = std::sqrt(a); break;
+    case Sin: v[i] = std::sin(a); break;
+    case Cos: v[i] = std::cos(a); break;
+    case Tan: v[i] = std::tan(a); break;
+    case ACos: v[i] = std::acos(a); break;
+    case ATan: v[i] = std::atan(a); break;
+    case Vec3: break;
+    }
+  }
+  for (size_t i = 0; i < m_roots.size(); ++i)
+    out[i] = v[m_roots[i]];
+}
+
+float FeExpr::operator()(float t) const
+{
+  float r;
+  eval(t, &r);
+  return r;
+}
@@ -0,0 +1,96 @@
+#ifndef FEEXPR_H
+#define FEEXPR_H
+
+#include <vector>
+
+typedef struct fe_Object fe_Object;
+typedef struct fe_Context fe_Context;
+
+// Native form of a pure fe closure of time, e.g. (fn (t) (fsin t 0.5)).
+// Evaluating it needs no fe context, does not allocate and never runs the gc.
+// Numbers the closure captured are taken as they are when it is lowered,
+// reading a global number keeps it a closure.
+class FeExpr
+{
+public:
+  enum Op
+  {
+    Const,
+    Time,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Lt,
+    Lte,
+    Not,
+    And,
+    Or,
+    If,
+    Mod,
+    Max,
+    Min,
+    Rad,
+    Deg,
+    FSin,
+    FCos,
+    Floor,
+    Ceil,
+    Abs,
+    Sqrt,
+    Sin,
+    Cos,
+    Tan,
+    ACos,
+    ATan,
+    Vec3,
+  };
+
+  using NativeFn = fe_Object *(*)(fe_Context *, fe_Object *);
+
+  // declares a cfunc as the fe side of a native operation
+  static void define(NativeFn f, Op op);
+
+  // lowers fn to `size` values (1 for numbers, 3 for a vec3 result), false if fn is not pure
+  bool lower(fe_Context *ctx, fe_Object *fn, int size = 1);
+
+  // true if the result does not depend on time, so it can be evaluated once
+  bool constant() const;
+
+  void eval(float t, float *out) const;
+  float operator()(float t) const;
+
+private:
+  struct Node
+  {
+    Op op;
+    float k;
+    int a, b, c;
+  };
+  struct Local
+  {
+    fe_Object *sym;
+    int node;
+  };
+
+  int node(Op op, int a = -1, int b = -1, int c = -1, float k = 0.0f);
+  int fold(Op op, int first, fe_Object *args);
+  int lower_expr(fe_Object *x, bool cond = false);
+  int lower_call(Op op, fe_Object *args);
+  int lower_prim(const char *name, fe_Object *args, bool cond);
+  int lower_body(fe_Object *body);
+  bool is_local(fe_Object *sym) const;
+  bool is_cond(int n) const;
+
+  fe_Context *m_ctx{nullptr};
+  fe_Object *m_fn{nullptr};
+  fe_Object *m_param{nullptr};
+  int m_size{1};
+  std::vector<Local> m_locals;
+
+  std::vector<Node> m_nodes;
+  std::vector<int> m_roots;
+  mutable std::vector<float> m_values;
+};
+
+#endif // FEEXPR_H
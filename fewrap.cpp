@@ -1,12 +1,19 @@
 #include "fewrap.h"
 
 #include "SceneHandler.h"
+#include "feexpr.h"
 #include "renderobject.h"
 
 #include <QDebug>
 #include <QDir>
 #include <QFile>
+#include <QSet>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <new>
 #include <string>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
@@ -19,12 +26,6 @@ using slm::vec3;
 
 using CustomPtr = std::variant<RenderObjectPtr, s_float, s_vec3, vec3, QColor, FeWrap *>;
 
-static char read_fn(fe_Context *, void *vit)
-{
-  auto *it = reinterpret_cast<QByteArray::iterator *>(vit);
-  return *((*it)++);
-}
-
 static void write_fn(fe_Context *, void *udata, char c)
 {
   auto *string = reinterpret_cast<QString *>(udata);
@@ -35,14 +36,69 @@ static QString from_string(fe_Context *ctx, fe_Object *o)
 {
   if (!o)
     return QStringLiteral("nil");
+  if (fe_type(ctx, o) == FE_TSTRING || fe_type(ctx, o) == FE_TSYMBOL)
+    return QString::fromLatin1(fe_strptr(ctx, o), fe_strlen(ctx, o));
   QString t;
   fe_write(ctx, o, write_fn, &t, false);
   return t;
 }
 
+// Custom values live in slabs of slots. Slots freed by the gc are reused by
+// the next custom(), so an eval asks the heap for a few slabs rather than
+// one allocation per value. Slabs stay until the program ends.
+class CustomPool
+{
+public:
+  template <typename T> CustomPtr *make(T &&o)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_free)
+      grow();
+    auto *s = m_free;
+    m_free = s->next;
+    return new (s->data) CustomPtr{std::forward<T>(o)};
+  }
+
+  void release(CustomPtr *p)
+  {
+    p->~CustomPtr();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto *s = reinterpret_cast<Slot *>(p);
+    s->next = m_free;
+    m_free = s;
+  }
+
+private:
+  union Slot
+  {
+    Slot *next;
+    alignas(CustomPtr) unsigned char data[sizeof(CustomPtr)];
+  };
+
+  void grow()
+  {
+    m_slabs.emplace_back(new Slot[m_slabSize]);
+    auto *slab = m_slabs.back().get();
+    for (int i = 0; i < m_slabSize; ++i)
+      slab[i].next = i + 1 < m_slabSize ? &slab[i + 1] : nullptr;
+    m_free = slab;
+  }
+
+  static const int m_slabSize{256};
+  std::vector<std::unique_ptr<Slot[]>> m_slabs;
+  Slot *m_free{nullptr};
+  std::mutex m_mutex;
+};
+
+static CustomPool &pool()
+{
+  static CustomPool p;
+  return p;
+}
+
 template <typename T> fe_Object *custom(fe_Context *ctx, T o)
 {
-  return fe_ptr(ctx, new CustomPtr{std::move(o)});
+  return fe_ptr(ctx, pool().make(std::move(o)));
 }
 
 template <typename T, typename... Args> fe_Object *create_custom(fe_Context *ctx, Args &&...args)
@@ -79,38 +135,101 @@ SceneHandler *_scene(fe_Context *ctx)
   return _self(ctx)->scene();
 }
 
-static std::vector<std::string> keys;
-std::string unique_key()
+// Roots of tickers, which may die on any thread. The next eval, which owns
+// the context, removes them.
+static std::mutex released_lock;
+static std::vector<std::pair<fe_Context *, int>> released;
+
+// keeps o alive while the ticker calling it is
+static std::shared_ptr<void> rooted(fe_Context *ctx, fe_Object *o)
 {
-  static int count = 0;
+  const auto root = fe_addroot(ctx, o);
+  return std::shared_ptr<void>(nullptr, [ctx, root](void *) {
+    std::lock_guard<std::mutex> lock(released_lock);
+    released.emplace_back(ctx, root);
+  });
+}
 
-  std::string key;
-  if (keys.empty())
+static void remove_released(fe_Context *ctx)
+{
+  std::lock_guard<std::mutex> lock(released_lock);
+  auto kept = released.begin();
+  for (const auto &r : released)
   {
-    key = "__g_" + std::to_string(count++);
+    if (r.first == ctx)
+      fe_removeroot(ctx, r.second);
+    else
+      *kept++ = r;
   }
-  else
+  released.erase(kept, released.end());
+}
+
+static std::vector<const float *> params(const s_float &v)
+{
+  return {v.get()};
+}
+
+static std::vector<const float *> params(const s_vec3 &v)
+{
+  return {v[0].get(), v[1].get(), v[2].get()};
+}
+
+// no limits, as outside of an eval, where tickers call fe code
+static void end_budget(fe_Context *ctx)
+{
+  auto *b = fe_budget(ctx);
+  b->steps = -1;
+  b->poll = nullptr;
+  fe_cancel(ctx, 0);
+}
+
+// registers t as the ticker writing v from the values in reads
+template <typename V>
+static void tick(fe_Context *ctx, const V &v, Tick t, std::vector<const float *> reads = {}, float period = 0.0f)
+{
+  _scene(ctx)->on_tick({std::move(t), params(v), std::move(reads), period});
+}
+
+static void collect_symbols(fe_Context *ctx, fe_Object *o, QSet<fe_Object *> &symbols)
+{
+  for (; fe_type(ctx, o) == FE_TPAIR; o = fe_cdr(ctx, o))
+    collect_symbols(ctx, fe_car(ctx, o), symbols);
+  if (fe_type(ctx, o) == FE_TSYMBOL)
+    symbols.insert(o);
+}
+
+// Animated values o can reach, through lists and the values of the symbols
+// closures mention. A symbol reassigned later to another value is not seen.
+static void fe_reads(fe_Context *ctx, fe_Object *o, QSet<fe_Object *> &seen, std::vector<const float *> &reads)
+{
+  for (; !seen.contains(o); o = fe_cdr(ctx, o))
   {
-    key = keys.back();
-    keys.pop_back();
+    seen.insert(o);
+    if (is<s_float>(ctx, o) || is<s_vec3>(ctx, o))
+    {
+      const auto p = is<s_float>(ctx, o) ? params(get<s_float>(ctx, o)) : params(get<s_vec3>(ctx, o));
+      reads.insert(reads.end(), p.begin(), p.end());
+    }
+    if (fe_type(ctx, o) == FE_TFUNC || fe_type(ctx, o) == FE_TMACRO)
+    {
+      QSet<fe_Object *> symbols;
+      collect_symbols(ctx, fe_fnbody(ctx, o), symbols);
+      for (auto *s : qAsConst(symbols))
+        fe_reads(ctx, fe_fnlookup(ctx, o, s), seen, reads);
+    }
+    if (fe_type(ctx, o) != FE_TPAIR)
+      return;
+    fe_reads(ctx, fe_car(ctx, o), seen, reads);
   }
-  return key;
 }
 
-template <typename R> std::shared_ptr<R> shared_d(fe_Context *ctx, fe_Object *o, const R &v)
+// a ticker calling the fe closure fn
+template <typename V> static void fe_tick(fe_Context *ctx, const V &v, fe_Object *fn, Tick t)
 {
-  const auto key = unique_key();
-  int gc = fe_savegc(ctx);
-  fe_set(ctx, fe_symbol(ctx, key.c_str()), o);
-  fe_restoregc(ctx, gc);
-
-  auto r = shared(v, [ctx, key](auto *x) {
-    delete x;
-    int gc = fe_savegc(ctx);
-    fe_restoregc(ctx, gc);
-    keys.push_back(key);
-  });
-  return r;
+  QSet<fe_Object *> seen;
+  std::vector<const float *> reads;
+  fe_reads(ctx, fn, seen, reads);
+  tick(ctx, v, std::move(t), std::move(reads));
 }
 
 static s_float s_number(fe_Context *ctx, fe_Object *o)
@@ -120,15 +239,29 @@ static s_float s_number(fe_Context *ctx, fe_Object *o)
 
   if (fe_type(ctx, o) == FE_TFUNC)
   {
-    auto r = shared_d(ctx, o, 0.0f);
+    FeExpr e;
+    if (e.lower(ctx, o))
+    {
+      if (e.constant())
+        return shared(e(0.0f));
+      auto r = shared(0.0f);
+      tick(ctx, r, [r, e](auto t) { e.eval(t, r.get()); });
+      return r;
+    }
 
-    _scene(ctx)->on_tick([r, ctx, o](auto t) {
+    auto r = shared(0.0f);
+
+    auto *self = _self(ctx);
+    fe_tick(ctx, r, o, [r, ctx, o, self, root = rooted(ctx, o)](auto t) {
+      // while an eval owns the context the last value stays
+      std::unique_lock<QMutex> lock(self->mutex(), std::try_to_lock);
+      if (!lock.owns_lock())
+        return;
+      end_budget(ctx);
       int gc = fe_savegc(ctx);
 
-      fe_Object *objs[2];
-      objs[0] = o;
-      objs[1] = fe_number(ctx, t);
-      *r = fe_tonumber(ctx, fe_eval(ctx, fe_list(ctx, objs, 2)));
+      fe_Object *arg = fe_number(ctx, t);
+      *r = fe_tonumber(ctx, fe_call(ctx, o, &arg, 1));
 
       fe_restoregc(ctx, gc);
     });
@@ -138,6 +271,14 @@ static s_float s_number(fe_Context *ctx, fe_Object *o)
   return shared(fe_tonumber(ctx, o));
 }
 
+static vec3 vec_value(fe_Context *ctx, fe_Object *o)
+{
+  if (is<vec3>(ctx, o))
+    return get<vec3>(ctx, o);
+  const auto v = get<s_vec3>(ctx, o);
+  return vec3(*v[0], *v[1], *v[2]);
+}
+
 static s_vec3 s_vec(fe_Context *ctx, fe_Object *o)
 {
   if (is<s_vec3>(ctx, o))
@@ -145,17 +286,40 @@ static s_vec3 s_vec(fe_Context *ctx, fe_Object *o)
 
   if (fe_type(ctx, o) == FE_TFUNC)
   {
-    auto r = s_vec3{shared_d(ctx, o, 0.0f), shared_d(ctx, o, 0.0f), shared_d(ctx, o, 0.0f)};
-    _scene(ctx)->on_tick([r, ctx, o](auto t) {
+    FeExpr e;
+    if (e.lower(ctx, o, 3))
+    {
+      if (e.constant())
+      {
+        float v[3];
+        e.eval(0.0f, v);
+        return shared(vec3(v[0], v[1], v[2]));
+      }
+      auto r = shared(vec3(0.0f));
+      tick(ctx, r, [r, e](auto t) {
+        float v[3];
+        e.eval(t, v);
+        *r[0] = v[0];
+        *r[1] = v[1];
+        *r[2] = v[2];
+      });
+      return r;
+    }
+
+    auto r = shared(vec3(0.0f));
+    auto *self = _self(ctx);
+    fe_tick(ctx, r, o, [r, ctx, o, self, root = rooted(ctx, o)](auto t) {
+      std::unique_lock<QMutex> lock(self->mutex(), std::try_to_lock);
+      if (!lock.owns_lock())
+        return;
+      end_budget(ctx);
       int gc = fe_savegc(ctx);
 
-      fe_Object *objs[2];
-      objs[0] = o;
-      objs[1] = fe_number(ctx, t);
-      const auto v = get<s_vec3>(ctx, fe_eval(ctx, fe_list(ctx, objs, 2)));
-      *r[0] = *v[0];
-      *r[1] = *v[1];
-      *r[2] = *v[2];
+      fe_Object *arg = fe_number(ctx, t);
+      const auto v = vec_value(ctx, fe_call(ctx, o, &arg, 1));
+      *r[0] = v.x;
+      *r[1] = v.y;
+      *r[2] = v.z;
       fe_restoregc(ctx, gc);
     });
     return r;
@@ -164,6 +328,52 @@ static s_vec3 s_vec(fe_Context *ctx, fe_Object *o)
   return shared(get<slm::vec3>(ctx, o));
 }
 
+// Operands of the vec3 operations, curves and keys. Constant ones are folded
+// right away, an animated one makes the result animated, recomputed by a
+// ticker. Once a scene is shown the gui thread writes animated values, so
+// only tickers read them.
+struct VecOperand
+{
+  vec3 k;
+  s_vec3 s;
+
+  bool animated() const { return s[0] != nullptr; }
+  vec3 operator()() const { return s[0] ? vec3(*s[0], *s[1], *s[2]) : k; }
+  void reads(std::vector<const float *> &p) const
+  {
+    if (animated())
+      p.insert(p.end(), {s[0].get(), s[1].get(), s[2].get()});
+  }
+};
+
+struct NumOperand
+{
+  float k;
+  s_float s;
+
+  bool animated() const { return s != nullptr; }
+  float operator()() const { return s ? *s : k; }
+  void reads(std::vector<const float *> &p) const
+  {
+    if (animated())
+      p.push_back(s.get());
+  }
+};
+
+static VecOperand vec_operand(fe_Context *ctx, fe_Object *o)
+{
+  if (is<vec3>(ctx, o))
+    return {get<vec3>(ctx, o), {}};
+  return {vec3(0.0f), s_vec(ctx, o)};
+}
+
+static NumOperand num_operand(fe_Context *ctx, fe_Object *o)
+{
+  if (fe_type(ctx, o) == FE_TNUMBER)
+    return {fe_tonumber(ctx, o), nullptr};
+  return {0.0f, s_number(ctx, o)};
+}
+
 static RenderObjectPtr _uobj(fe_Context *ctx, fe_Object *o)
 {
   if (!is<RenderObjectPtr>(ctx, o))
@@ -173,61 +383,149 @@ static RenderObjectPtr _uobj(fe_Context *ctx, fe_Object *o)
   return std::get<RenderObjectPtr>(*custom);
 }
 
-FeWrap::FeWrap(SceneHandler &s)
+[[noreturn]] static void on_read_error(fe_Context *, const char *err, fe_Object *)
+{
+  throw std::runtime_error(err);
+}
+
+FeWrap::FeWrap()
   : m_data{malloc(m_size)}
   , m_fe{fe_open(m_data, m_size)}
-  , m_scene{s}
+  , m_readerData{malloc(m_readerSize)}
+  , m_reader{fe_open(m_readerData, m_readerSize)}
 {
+  for (auto *ctx : {m_fe, m_reader})
+  {
+    auto *hp = fe_heappolicy(ctx);
+    hp->segment = m_segmentSize;
+    hp->growth = m_heapGrowth;
+    hp->nursery = m_nurserySize;
+  }
+
   init_fn(m_fe);
+  fe_handlers(m_reader)->error = on_read_error;
 }
 
 FeWrap::~FeWrap()
 {
+  remove_released(m_fe);
+  setRoot(m_modulesRoot, nullptr);
+  setRoot(m_snapshotRoot, nullptr);
+  setRoot(m_formsRoot, nullptr);
   fe_close(m_fe);
   free(m_data);
+  fe_close(m_reader);
+  free(m_readerData);
 }
 
 QString FeWrap::newSession(const QString &f)
 {
+  QMutexLocker lock(&m_mutex);
   m_hasChanges = false;
   m_mainFile = QFileInfo(f).fileName();
-  m_fileContents.clear();
+  {
+    QMutexLocker filesLock(&m_filesLock);
+    m_fileContents.clear();
+  }
+  m_modules.clear();
+  rootModules();
+  m_snapshot = Snapshot();
+  setRoot(m_snapshotRoot, nullptr);
+  m_forms.clear();
+  m_bindings.clear();
+  rootForms();
   QDir::setCurrent(QFileInfo(f).absolutePath());
   return m_mainFile;
 }
 
-QString FeWrap::eval()
+QString FeWrap::eval(SceneHandler &s, int msecs, long steps)
 {
+  QMutexLocker lock(&m_mutex);
+  remove_released(m_fe);
+  m_scene.target = &s;
+  {
+    QMutexLocker cancelLock(&m_cancelLock);
+    m_running = true;
+  }
+  auto *b = fe_budget(m_fe);
+  b->steps = steps;
+  m_deadline.setRemainingTime(msecs);
+  b->poll = msecs > 0 ? _expired : nullptr;
   setlocale(LC_ALL, "C");
   m_evalStackBackup = fe_savegc(m_fe);
   // qDebug() << "stack" << m_evalStackBackup;
 
-  const auto last_text = from_string(m_fe, _eval(m_fe, codeOf(m_mainFile)));
+  const auto fet = loadCode(m_mainFile).toLocal8Bit();
+  const char *it = fet.constData();
+  const char *end = it + fet.size();
+
+  auto *last = evalPrelude(it, end);
+  if (auto *r = evalTopLevel(it, end))
+    last = r;
+  const auto last_text = from_string(m_fe, last);
 
+  endEval();
   fe_restoregc(m_fe, m_evalStackBackup);
   setlocale(LC_ALL, "");
   return last_text;
 }
 
+void FeWrap::endEval()
+{
+  m_scene.target = nullptr;
+  QMutexLocker cancelLock(&m_cancelLock);
+  m_running = false;
+  end_budget(m_fe);
+}
+
+void FeWrap::cancel()
+{
+  QMutexLocker cancelLock(&m_cancelLock);
+  if (m_running)
+    fe_cancel(m_fe, 1);
+}
+
 bool FeWrap::codeExists(const QString &f) const
 {
+  QMutexLocker lock(&m_filesLock);
   return m_fileContents.contains(f);
 }
 
 QString FeWrap::codeOf(const QString &f)
 {
-  if (!m_fileContents.contains(f))
+  QString code;
+  cachedCode(f, code);
+  return code;
+}
+
+bool FeWrap::cachedCode(const QString &f, QString &code)
+{
+  QMutexLocker lock(&m_filesLock);
+  auto it = m_fileContents.constFind(f);
+  if (it == m_fileContents.constEnd())
   {
     QFile fi(f);
     if (!fi.open(QFile::ReadOnly))
-      fe_error(m_fe, ("can't open file '" + f + "'").toLocal8Bit());
-    m_fileContents[f] = QString(fi.readAll());
+      return false;
+    it = m_fileContents.insert(f, QString(fi.readAll()));
   }
-  return m_fileContents.value(f);
+  code = *it;
+  return true;
+}
+
+QString FeWrap::loadCode(const QString &f)
+{
+  // a copy, the gui may change the file while it is evaluated
+  QString code;
+  if (!cachedCode(f, code))
+    fe_error(m_fe, ("can't open file '" + f + "'").toLocal8Bit());
+  return code;
 }
 
 void FeWrap::setCodeOf(const QString &f, const QString &c)
 {
+  // parsed modules are dropped by the next eval, their hash no longer matches
+  QMutexLocker lock(&m_filesLock);
   m_fileContents[f] = QString(c);
   m_hasChanges = true;
 }
@@ -336,7 +634,7 @@ QString FeWrap::format(const QString &fe)
   return made;
 }
 
-static QString asDefinition(fe_Context *ctx, fe_Object *o)
+static fe_Object *defined_symbol(fe_Context *ctx, fe_Object *o)
 {
   if (fe_type(ctx, o) == FE_TPAIR)
   {
@@ -347,50 +645,67 @@ static QString asDefinition(fe_Context *ctx, fe_Object *o)
       {
         s = fe_nextarg(ctx, &o);
         if (fe_type(ctx, s) == FE_TSYMBOL)
-          return from_string(ctx, s);
+          return s;
       }
     }
   }
 
+  return nullptr;
+}
+
+static QString asDefinition(fe_Context *ctx, fe_Object *o)
+{
+  if (auto *s = defined_symbol(ctx, o))
+    return from_string(ctx, s);
   return QString();
 }
 
 void FeWrap::eachDefinitionAtLine(const QString &fe, const LineDefinitionCB &cb)
 {
   const auto fet = fe.toLocal8Bit();
-  auto it = fet.begin();
+  const char *it = fet.constData();
+  const char *end = it + fet.size();
 
-  int gc = fe_savegc(m_fe);
+  int gc = fe_savegc(m_reader);
 
   int line = 1;
-  for (;;)
+  try
   {
-    while (it < fet.end() && QChar(*it).isSpace())
+    for (;;)
     {
-      if (*it == '\n')
-        ++line;
-      ++it;
-    }
-    auto oldIt = it;
-    auto *r = fe_read(m_fe, read_fn, &it);
-    if (!r)
-      break;
+      while (it < end && QChar(*it).isSpace())
+      {
+        if (*it == '\n')
+          ++line;
+        ++it;
+      }
+      auto oldIt = it;
+      auto *r = fe_readspan(m_reader, &it, end);
+      if (!r)
+        break;
 
-    const auto def = asDefinition(m_fe, r);
-    if (!def.isEmpty())
-    {
-      cb(line, def);
-    }
-    for (; oldIt < it; ++oldIt)
-      if (*oldIt == '\n')
-        line++;
+      const auto def = asDefinition(m_reader, r);
+      if (!def.isEmpty())
+      {
+        cb(line, def);
+      }
+      for (; oldIt < it; ++oldIt)
+        if (*oldIt == '\n')
+          line++;
 
-    fe_restoregc(m_fe, gc);
+      fe_restoregc(m_reader, gc);
+    }
   }
+  catch (const std::runtime_error &)
+  {
+    // definitions after a syntax error are not listed
+  }
+  fe_restoregc(m_reader, gc);
 }
 
 void FeWrap::saveFiles()
 {
+  QMutexLocker lock(&m_filesLock);
   for (auto it = m_fileContents.begin(); it != m_fileContents.end(); ++it)
   {
     QFileInfo(it.key()).absoluteDir().mkpath(".");
@@ -403,6 +718,7 @@ void FeWrap::saveFiles()
 
 QStringList FeWrap::usedFiles() const
 {
+  QMutexLocker lock(&m_filesLock);
   return m_fileContents.keys();
 }
 
@@ -441,6 +757,20 @@ fe_Object *FeWrap::_min(fe_Context *ctx, fe_Object *arg)
 
 fe_Object *FeWrap::_vec3(fe_Context *ctx, fe_Object *arg)
 {
+  // plain numbers give a constant vector
+  auto numbers = true;
+  for (auto *a = arg; numbers && !fe_isnil(ctx, a); a = fe_cdr(ctx, a))
+    numbers = fe_type(ctx, fe_car(ctx, a)) == FE_TNUMBER;
+  if (numbers)
+  {
+    const auto x = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+    if (fe_isnil(ctx, arg))
+      return custom(ctx, vec3(x));
+    const auto y = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+    const auto z = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+    return custom(ctx, vec3(x, y, z));
+  }
+
   auto x = s_number(ctx, fe_nextarg(ctx, &arg));
   if (fe_isnil(ctx, arg))
     return custom(ctx, s_vec3{x, x, x});
@@ -469,15 +799,23 @@ fe_Object *FeWrap::_color(fe_Context *ctx, fe_Object *arg)
 fe_Object *FeWrap::_cube(fe_Context *ctx, fe_Object *arg)
 {
   auto c = std::make_unique<RenderDisplayObject>(RenderObject::primitives->cube());
+  // the scale of the cube itself is fixed, a container follows an animated one
+  std::unique_ptr<ScaleContainer> scale;
   if (!fe_isnil(ctx, arg))
   {
-    auto v = s_vec(ctx, fe_nextarg(ctx, &arg));
-    c->set_scale(slm::vec3(*v[0], *v[1], *v[2]));
+    auto *s = fe_nextarg(ctx, &arg);
+    if (is<vec3>(ctx, s))
+      c->set_scale(get<vec3>(ctx, s));
+    else
+      scale = std::make_unique<ScaleContainer>(s_vec(ctx, s));
   }
   if (!fe_isnil(ctx, arg))
     c->setColor(get<QColor>(ctx, fe_nextarg(ctx, &arg)));
 
-  return custom(ctx, std::move(c));
+  if (!scale)
+    return custom(ctx, std::move(c));
+  scale->add(std::move(c));
+  return custom(ctx, std::move(scale));
 }
 
 void FeWrap::add_all(RenderContainer &c, fe_Context *ctx, fe_Object **arg)
@@ -491,9 +829,10 @@ fe_Object *FeWrap::_animation(fe_Context *ctx, fe_Object *arg)
   auto *sh = _scene(ctx);
   const auto name = from_string(ctx, fe_nextarg(ctx, &arg));
   const auto length = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
-  auto v = s_vec(ctx, fe_nextarg(ctx, &arg));
-  const auto lp = vec3(*v[0], *v[1], *v[2]);
-  sh->add_animation(name, length, lp, _uobj(ctx, fe_nextarg(ctx, &arg)));
+  auto *lp = fe_nextarg(ctx, &arg);
+  if (!is<vec3>(ctx, lp))
+    fe_error(ctx, "animation: the light position must be a fixed vec3");
+  sh->add_animation(name, length, get<vec3>(ctx, lp), _uobj(ctx, fe_nextarg(ctx, &arg)));
 
   return fe_bool(ctx, false);
 }
@@ -577,13 +916,17 @@ fe_Object *FeWrap::_scale(fe_Context *ctx, fe_Object *arg)
   return custom(ctx, std::move(c));
 }
 
-template <typename T> fe_Object *_lfo_i(fe_Context *ctx, T center, T amp, float frequency)
+static fe_Object *_lfo_i(fe_Context *ctx, float center, float amp, float frequency)
 {
   auto value = shared(center);
 
-  _scene(ctx)->on_tick([value, center, amp, frequency](auto t) {
-    *value = center + amp * float(sin(double(t) * M_PI * 2.0 * double(frequency)));
-  });
+  Ticker ticker{[value, center, amp, frequency](auto t) {
+                  *value = center + amp * float(sin(double(t) * M_PI * 2.0 * double(frequency)));
+                },
+                params(value)};
+  ticker.period = frequency != 0.0f ? 1.0f / std::abs(frequency) : -1.0f;
+  ticker.wave = Ticker::Wave{center, amp, frequency, value.get()};
+  _scene(ctx)->on_tick(ticker);
 
   return custom(ctx, value);
 }
@@ -597,19 +940,800 @@ fe_Object *FeWrap::_lfo(fe_Context *ctx, fe_Object *arg)
   return _lfo_i(ctx, center, amp, frequency);
 }
 
-fe_Object *FeWrap::_eval(fe_Context *ctx, const QString &fe)
+static void assign(const s_float &r, float v)
 {
-  const auto fet = fe.toLocal8Bit();
-  auto it = fet.begin();
+  *r = v;
+}
+
+static void assign(const s_vec3 &r, const vec3 &v)
+{
+  *r[0] = v.x;
+  *r[1] = v.y;
+  *r[2] = v.z;
+}
+
+// fraction of the current repetition of a curve lasting d seconds
+static float cycle(float t, float d)
+{
+  return d > 0.0f ? t / d - std::floor(t / d) : 1.0f;
+}
+
+// Ticker::period of a curve over cycle(t, d), which stays at its end for
+// d <= 0. Only one ending where it starts repeats without a jump.
+static float cycle_period(float d, bool closed)
+{
+  if (d <= 0.0f)
+    return -1.0f;
+  return closed ? d : 0.0f;
+}
+
+// the Ticker::period of a curve between endpoints, of which animated ones
+// may end it elsewhere than it starts
+static float curve_period(float d, bool closed, const std::vector<const float *> &reads)
+{
+  return reads.empty() || d <= 0.0f ? cycle_period(d, closed) : 0.0f;
+}
+
+template <typename O, typename F>
+fe_Object *_curve_i(fe_Context *ctx, O from, O to, float duration, F curve, bool closed)
+{
+  using T = decltype(from());
+  std::vector<const float *> reads;
+  from.reads(reads);
+  to.reads(reads);
+  auto value = shared(from.animated() ? T(0.0f) : from());
+
+  tick(
+    ctx, value,
+    [value, from, to, duration, curve](auto t) {
+      const auto a = from();
+      assign(value, a + (to() - a) * curve(cycle(float(t), duration)));
+    },
+    reads, curve_period(duration, closed, reads));
+
+  return custom(ctx, value);
+}
+
+// (name from to duration ...) with numbers or vec3 values, repeating every
+// duration. A closed curve ends at from again. Animated endpoints are
+// followed like the operands of the vec3 operations.
+template <typename F>
+static fe_Object *curve(fe_Context *ctx, fe_Object *from, fe_Object *to, float d, F f, bool closed = false)
+{
+  if (is<vec3>(ctx, from) || is<s_vec3>(ctx, from))
+    return _curve_i(ctx, vec_operand(ctx, from), vec_operand(ctx, to), d, f, closed);
+  return _curve_i(ctx, num_operand(ctx, from), num_operand(ctx, to), d, f, closed);
+}
+
+fe_Object *FeWrap::_easeIn(fe_Context *ctx, fe_Object *arg)
+{
+  auto *from = fe_nextarg(ctx, &arg);
+  auto *to = fe_nextarg(ctx, &arg);
+  const auto d = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  return curve(ctx, from, to, d, [](float u) { return u * u * u; });
+}
+
+fe_Object *FeWrap::_easeOut(fe_Context *ctx, fe_Object *arg)
+{
+  auto *from = fe_nextarg(ctx, &arg);
+  auto *to = fe_nextarg(ctx, &arg);
+  const auto d = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  return curve(ctx, from, to, d, [](float u) {
+    const auto v = 1.0f - u;
+    return 1.0f - v * v * v;
+  });
+}
+
+fe_Object *FeWrap::_easeInOut(fe_Context *ctx, fe_Object *arg)
+{
+  auto *from = fe_nextarg(ctx, &arg);
+  auto *to = fe_nextarg(ctx, &arg);
+  const auto d = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  return curve(ctx, from, to, d, [](float u) {
+    if (u < 0.5f)
+      return 4.0f * u * u * u;
+    const auto v = 2.0f - 2.0f * u;
+    return 1.0f - 0.5f * v * v * v;
+  });
+}
+
+fe_Object *FeWrap::_bezier(fe_Context *ctx, fe_Object *arg)
+{
+  // (bezier x1 y1 x2 y2 from to duration), the timing curve of css cubic-bezier
+  const auto x1 = std::clamp(fe_tonumber(ctx, fe_nextarg(ctx, &arg)), 0.0f, 1.0f);
+  const auto y1 = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  const auto x2 = std::clamp(fe_tonumber(ctx, fe_nextarg(ctx, &arg)), 0.0f, 1.0f);
+  const auto y2 = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  auto *from = fe_nextarg(ctx, &arg);
+  auto *to = fe_nextarg(ctx, &arg);
+  const auto d = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  return curve(ctx, from, to, d, [x1, y1, x2, y2](float u) {
+    const auto bez = [](float p1, float p2, float s) {
+      const auto r = 1.0f - s;
+      return 3.0f * r * r * s * p1 + 3.0f * r * s * s * p2 + s * s * s;
+    };
+    // x(s) is monotonic for x1, x2 in [0, 1], bisect for the s giving u
+    auto lo = 0.0f, hi = 1.0f, s = u;
+    for (int i = 0; i < 20; ++i)
+    {
+      if (bez(x1, x2, s) < u)
+        lo = s;
+      else
+        hi = s;
+      s = 0.5f * (lo + hi);
+    }
+    return bez(y1, y2, s);
+  });
+}
+
+fe_Object *FeWrap::_step(fe_Context *ctx, fe_Object *arg)
+{
+  // (step from to duration [at]) holds from until the fraction at of duration
+  auto *from = fe_nextarg(ctx, &arg);
+  auto *to = fe_nextarg(ctx, &arg);
+  const auto d = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  auto at = 0.5f;
+  if (!fe_isnil(ctx, arg))
+    at = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  return curve(ctx, from, to, d, [at](float u) { return u < at ? 0.0f : 1.0f; });
+}
+
+fe_Object *FeWrap::_pingpong(fe_Context *ctx, fe_Object *arg)
+{
+  auto *from = fe_nextarg(ctx, &arg);
+  auto *to = fe_nextarg(ctx, &arg);
+  const auto d = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  return curve(
+    ctx, from, to, d, [](float u) { return u < 0.5f ? 2.0f * u : 2.0f - 2.0f * u; }, true);
+}
+
+template <typename O> fe_Object *_spline_i(fe_Context *ctx, std::vector<O> points, float duration)
+{
+  using T = decltype(points.front()());
+  std::vector<const float *> reads;
+  for (const auto &p : points)
+    p.reads(reads);
+  const auto animated = !reads.empty();
+  auto value = shared(animated ? T(0.0f) : points.front()());
+  const auto period =
+    curve_period(duration, !animated && points.front()() == points.back()(), reads);
+
+  tick(
+    ctx, value,
+    [value, points, duration](auto t) {
+      const auto x = cycle(float(t), duration) * float(points.size() - 1);
+      const auto i = std::min(size_t(x), points.size() - 1);
+      const auto f = x - float(i);
+      const auto p0 = points[i > 0 ? i - 1 : i]();
+      const auto p1 = points[i]();
+      const auto p2 = points[std::min(i + 1, points.size() - 1)]();
+      const auto p3 = points[std::min(i + 2, points.size() - 1)]();
+      // uniform Catmull-Rom through p1 and p2
+      const auto f2 = f * f, f3 = f2 * f;
+      assign(value, (p1 * 2.0f + (p2 - p0) * f + (p0 * 2.0f - p1 * 5.0f + p2 * 4.0f - p3) * f2 +
+                     (p1 * 3.0f - p0 - p2 * 3.0f + p3) * f3) *
+                      0.5f);
+    },
+    reads, period);
+
+  return custom(ctx, value);
+}
+
+fe_Object *FeWrap::_spline(fe_Context *ctx, fe_Object *arg)
+{
+  // (spline duration p0 p1 ...) through numbers or vec3 values spread evenly over duration
+  const auto d = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  auto *p0 = fe_car(ctx, arg);
+  if (is<vec3>(ctx, p0) || is<s_vec3>(ctx, p0))
+  {
+    std::vector<VecOperand> points;
+    while (!fe_isnil(ctx, arg))
+      points.push_back(vec_operand(ctx, fe_nextarg(ctx, &arg)));
+    return _spline_i(ctx, std::move(points), d);
+  }
+
+  std::vector<NumOperand> points;
+  while (!fe_isnil(ctx, arg))
+    points.push_back(num_operand(ctx, fe_nextarg(ctx, &arg)));
+  if (points.empty())
+    fe_error(ctx, "spline: no points");
+  return _spline_i(ctx, std::move(points), d);
+}
+
+// A keyframe track looping over its last key time. Sampling finds the
+// surrounding keys by binary search.
+template <typename O> struct KeyTrack
+{
+  using T = decltype(std::declval<O>()());
+
+  enum Mode
+  {
+    Step,
+    Linear,
+    Smooth,
+  };
+
+  Mode mode{Linear};
+  std::vector<float> times;
+  std::vector<O> values;
+
+  T operator()(float t) const
+  {
+    const auto period = times.back();
+    if (period > 0.0f)
+      t -= std::floor(t / period) * period;
+
+    const auto it = std::upper_bound(times.begin(), times.end(), t);
+    if (it == times.begin())
+      return values.front()();
+    if (it == times.end())
+      return values.back()();
+
+    const auto i = size_t(it - times.begin());
+    if (mode == Step)
+      return values[i - 1]();
+    auto f = (t - times[i - 1]) / (times[i] - times[i - 1]);
+    if (mode == Smooth)
+      f = f * f * (3.0f - 2.0f * f);
+    const auto a = values[i - 1]();
+    return a + (values[i]() - a) * f;
+  }
+
+  bool animated() const
+  {
+    return std::any_of(values.begin(), values.end(), [](const auto &v) { return v.animated(); });
+  }
+
+  void reads(std::vector<const float *> &p) const
+  {
+    for (const auto &v : values)
+      v.reads(p);
+  }
+
+  // Ticker::period, the loop only has no jump if it ends where it starts,
+  // which animated keys may not
+  float period() const
+  {
+    if (animated())
+      return 0.0f;
+    const auto closed = mode != Step && values.front()() == values.back()();
+    return closed && times.back() > 0.0f ? times.back() : 0.0f;
+  }
+};
+
+template <typename O> static KeyTrack<O> key_track(fe_Context *ctx, fe_Object *arg, int mode)
+{
+  KeyTrack<O> k;
+  k.mode = typename KeyTrack<O>::Mode(mode);
+  while (!fe_isnil(ctx, arg))
+  {
+    const auto t = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+    if (!k.times.empty() && t < k.times.back())
+      fe_error(ctx, "keys: times must not decrease");
+    k.times.push_back(t);
+    auto *v = fe_nextarg(ctx, &arg);
+    if constexpr (std::is_same_v<O, VecOperand>)
+      k.values.push_back(vec_operand(ctx, v));
+    else
+      k.values.push_back(num_operand(ctx, v));
+  }
+  return k;
+}
+
+fe_Object *FeWrap::_keys(fe_Context *ctx, fe_Object *arg)
+{
+  // (keys ['step|'linear|'smooth] t0 v0 t1 v1 ...) with numbers or vec3 values, the
+  // mode may also be a string, e.g. (keys 'step 0 0 0.5 90 1 180), see assets/keys.fe
+  auto mode = int(KeyTrack<NumOperand>::Linear);
+  auto *a1 = fe_car(ctx, arg);
+  if (fe_type(ctx, a1) == FE_TSYMBOL || fe_type(ctx, a1) == FE_TSTRING)
+  {
+    const auto name = from_string(ctx, fe_nextarg(ctx, &arg));
+    if (name == "step")
+      mode = KeyTrack<NumOperand>::Step;
+    else if (name == "smooth")
+      mode = KeyTrack<NumOperand>::Smooth;
+    else if (name != "linear")
+      fe_error(ctx, "keys: unknown interpolation");
+  }
+  if (fe_isnil(ctx, arg))
+    fe_error(ctx, "keys: no keys");
+
+  auto *v0 = fe_car(ctx, fe_cdr(ctx, arg));
+  if (is<vec3>(ctx, v0) || is<s_vec3>(ctx, v0))
+  {
+    const auto k = key_track<VecOperand>(ctx, arg, mode);
+    std::vector<const float *> reads;
+    k.reads(reads);
+    auto r = shared(k.animated() ? vec3(0.0f) : k(0.0f));
+    tick(
+      ctx, r,
+      [r, k](auto t) {
+        const auto v = k(t);
+        *r[0] = v.x;
+        *r[1] = v.y;
+        *r[2] = v.z;
+      },
+      reads, k.period());
+    return custom(ctx, r);
+  }
+
+  const auto k = key_track<NumOperand>(ctx, arg, mode);
+  std::vector<const float *> reads;
+  k.reads(reads);
+  auto r = shared(k.animated() ? 0.0f : k(0.0f));
+  tick(
+    ctx, r, [r, k](auto t) { *r = k(t); }, reads, k.period());
+  return custom(ctx, r);
+}
+
+template <typename F, typename... A> static fe_Object *vec_op(fe_Context *ctx, F f, A... a)
+{
+  using R = decltype(f(a()...));
+  if (!(a.animated() || ...))
+  {
+    if constexpr (std::is_same_v<R, vec3>)
+      return custom(ctx, f(a()...));
+    else
+      return fe_number(ctx, f(a()...));
+  }
+
+  std::vector<const float *> reads;
+  (a.reads(reads), ...);
+
+  if constexpr (std::is_same_v<R, vec3>)
+  {
+    auto r = shared(vec3(0.0f));
+    tick(
+      ctx, r,
+      [r, f, a...](auto) {
+        const auto v = f(a()...);
+        *r[0] = v.x;
+        *r[1] = v.y;
+        *r[2] = v.z;
+      },
+      reads, -1.0f);
+    return custom(ctx, r);
+  }
+  else
+  {
+    auto r = shared(0.0f);
+    tick(
+      ctx, r, [r, f, a...](auto) { *r = f(a()...); }, reads, -1.0f);
+    return custom(ctx, r);
+  }
+}
+
+fe_Object *FeWrap::_vadd(fe_Context *ctx, fe_Object *arg)
+{
+  auto *r = fe_nextarg(ctx, &arg);
+  while (!fe_isnil(ctx, arg))
+    r = vec_op(
+      ctx, [](const vec3 &a, const vec3 &b) { return a + b; }, vec_operand(ctx, r),
+      vec_operand(ctx, fe_nextarg(ctx, &arg)));
+  return r;
+}
+
+fe_Object *FeWrap::_vsub(fe_Context *ctx, fe_Object *arg)
+{
+  auto *r = fe_nextarg(ctx, &arg);
+  if (fe_isnil(ctx, arg))
+    return vec_op(
+      ctx, [](const vec3 &a) { return -a; }, vec_operand(ctx, r));
+  while (!fe_isnil(ctx, arg))
+    r = vec_op(
+      ctx, [](const vec3 &a, const vec3 &b) { return a - b; }, vec_operand(ctx, r),
+      vec_operand(ctx, fe_nextarg(ctx, &arg)));
+  return r;
+}
+
+fe_Object *FeWrap::_vmul(fe_Context *ctx, fe_Object *arg)
+{
+  // a vector times vectors (componentwise) or scalars
+  auto *r = fe_nextarg(ctx, &arg);
+  while (!fe_isnil(ctx, arg))
+  {
+    auto *b = fe_nextarg(ctx, &arg);
+    if (is<vec3>(ctx, b) || is<s_vec3>(ctx, b))
+      r = vec_op(
+        ctx, [](const vec3 &x, const vec3 &y) { return x * y; }, vec_operand(ctx, r), vec_operand(ctx, b));
+    else
+      r = vec_op(
+        ctx, [](const vec3 &x, float y) { return x * y; }, vec_operand(ctx, r), num_operand(ctx, b));
+  }
+  return r;
+}
+
+fe_Object *FeWrap::_dot(fe_Context *ctx, fe_Object *arg)
+{
+  auto a = vec_operand(ctx, fe_nextarg(ctx, &arg));
+  auto b = vec_operand(ctx, fe_nextarg(ctx, &arg));
+  return vec_op(
+    ctx, [](const vec3 &x, const vec3 &y) { return slm::dot(x, y); }, a, b);
+}
+
+fe_Object *FeWrap::_cross(fe_Context *ctx, fe_Object *arg)
+{
+  auto a = vec_operand(ctx, fe_nextarg(ctx, &arg));
+  auto b = vec_operand(ctx, fe_nextarg(ctx, &arg));
+  return vec_op(
+    ctx, [](const vec3 &x, const vec3 &y) { return slm::cross(x, y); }, a, b);
+}
+
+fe_Object *FeWrap::_lerp(fe_Context *ctx, fe_Object *arg)
+{
+  auto a = vec_operand(ctx, fe_nextarg(ctx, &arg));
+  auto b = vec_operand(ctx, fe_nextarg(ctx, &arg));
+  auto t = num_operand(ctx, fe_nextarg(ctx, &arg));
+  return vec_op(
+    ctx, [](const vec3 &x, const vec3 &y, float s) { return slm::mix(x, y, s); }, a, b, t);
+}
+
+fe_Object *FeWrap::_length(fe_Context *ctx, fe_Object *arg)
+{
+  auto a = vec_operand(ctx, fe_nextarg(ctx, &arg));
+  return vec_op(
+    ctx, [](const vec3 &x) { return slm::length(x); }, a);
+}
+
+fe_Object *FeWrap::_normalize(fe_Context *ctx, fe_Object *arg)
+{
+  auto a = vec_operand(ctx, fe_nextarg(ctx, &arg));
+  return vec_op(
+    ctx,
+    [](const vec3 &x) {
+      const auto l = slm::length(x);
+      return l > 0.0f ? x / l : vec3(0.0f);
+    },
+    a);
+}
+
+fe_Object *FeWrap::moduleForms(const QString &f)
+{
+  const auto code = loadCode(f);
+  const auto hash = qHash(code);
+  m_required[f] = hash;
+  const auto it = m_modules.constFind(f);
+  if (it != m_modules.constEnd() && it->hash == hash)
+    return it->forms;
+
+  const auto fet = code.toLocal8Bit();
+  const char *p = fet.constData();
+  const char *end = p + fet.size();
+
+  // read into a reversed list first to keep the gc stack flat
+  int gc = fe_savegc(m_fe);
+  auto *rev = fe_bool(m_fe, false);
+  while (auto *r = fe_readspan(m_fe, &p, end))
+  {
+    rev = fe_cons(m_fe, r, rev);
+    fe_restoregc(m_fe, gc);
+    fe_pushgc(m_fe, rev);
+  }
+  auto *forms = fe_bool(m_fe, false);
+  while (!fe_isnil(m_fe, rev))
+  {
+    forms = fe_cons(m_fe, fe_nextarg(m_fe, &rev), forms);
+    fe_restoregc(m_fe, gc);
+    fe_pushgc(m_fe, rev);
+    fe_pushgc(m_fe, forms);
+  }
+
+  m_modules[f] = {hash, forms};
+  rootModules();
+  fe_restoregc(m_fe, gc);
+  fe_pushgc(m_fe, forms);
+  return forms;
+}
+
+void FeWrap::setRoot(int &root, fe_Object *o)
+{
+  if (root >= 0)
+    fe_removeroot(m_fe, root);
+  root = o ? fe_addroot(m_fe, o) : -1;
+}
+
+void FeWrap::rootModules()
+{
+  // cached forms stay alive through the root table
+  int gc = fe_savegc(m_fe);
+  auto *l = fe_bool(m_fe, false);
+  for (const auto &m : m_modules)
+    l = fe_cons(m_fe, m.forms, l);
+  setRoot(m_modulesRoot, l);
+  fe_restoregc(m_fe, gc);
+}
+
+static bool is_require(fe_Context *ctx, fe_Object *o)
+{
+  if (fe_type(ctx, o) != FE_TPAIR)
+    return false;
+  auto *s = fe_car(ctx, o);
+  return fe_type(ctx, s) == FE_TSYMBOL && from_string(ctx, s) == "require";
+}
+
+fe_Object *FeWrap::evalPrelude(const char *&it, const char *end)
+{
+  // The leading (require ...) forms of the main file. While neither they nor the
+  // files they loaded change, the global bindings they left are restored instead.
+  const auto *begin = it;
+  std::vector<fe_Object *> forms;
+  for (;;)
+  {
+    const auto *form = it;
+    auto *r = fe_readspan(m_fe, &it, end);
+    if (!r || !is_require(m_fe, r))
+    {
+      it = form;
+      break;
+    }
+    forms.push_back(r);
+    fe_pushgc(m_fe, r);
+  }
+  if (forms.empty())
+    return nullptr;
+
+  const QByteArray prelude(begin, int(it - begin));
+  auto unchanged = [this](const QHash<QString, uint> &modules) {
+    for (auto m = modules.constBegin(); m != modules.constEnd(); ++m)
+      if (qHash(loadCode(m.key())) != m.value())
+        return false;
+    return true;
+  };
+  if (m_snapshot.bindings && m_snapshot.prelude == prelude && unchanged(m_snapshot.modules))
+  {
+    for (auto *l = m_snapshot.bindings; !fe_isnil(m_fe, l);)
+    {
+      auto *b = fe_nextarg(m_fe, &l);
+      fe_set(m_fe, fe_car(m_fe, b), fe_cdr(m_fe, b));
+    }
+    return m_snapshot.last;
+  }
+
+  m_snapshot = Snapshot();
+  setRoot(m_snapshotRoot, nullptr);
+  m_required.clear();
+  const auto sceneChanges = m_scene.changes;
 
   fe_Object *last{nullptr};
-  int gc = fe_savegc(ctx);
+  int gc = fe_savegc(m_fe);
+  for (auto *r : forms)
+  {
+    last = fe_eval(m_fe, r);
+
+    fe_restoregc(m_fe, gc);
+    fe_pushgc(m_fe, last);
+  }
+
+  // tickers and animations of the prelude die with the scene, so only a
+  // prelude that made none can be restored later
+  if (m_scene.changes == sceneChanges)
+  {
+    m_snapshot = {prelude, m_required, fe_snapshot(m_fe), last};
+    setRoot(m_snapshotRoot, fe_cons(m_fe, last, m_snapshot.bindings));
+    fe_restoregc(m_fe, gc);
+    fe_pushgc(m_fe, last);
+  }
+  return last;
+}
+
+fe_Object *FeWrap::evalTopLevel(const char *it, const char *end)
+{
+  // A top level form is evaluated again only if its text changed, a symbol it
+  // mentions holds another value than after the last eval or a form defining
+  // such a symbol is evaluated again. All others keep their value and replay
+  // the animations and tickers they added. A form with side effects may change
+  // what any other one sees, so the forms after it and the next eval are
+  // evaluated completely.
+  auto previous = std::move(m_forms);
+  const auto bindings = std::move(m_bindings);
+  m_forms.clear();
+  m_bindings.clear();
+
+  QMultiHash<QByteArray, size_t> unmatched;
+  for (size_t i = 0; i < previous.size(); ++i)
+    unmatched.insert(previous[i].text, i);
+
+  auto *require = fe_symbol(m_fe, "require");
+  bool incremental =
+    std::none_of(previous.begin(), previous.end(), [](const auto &f) { return f.sideEffects; });
+  std::vector<fe_Object *> parsed;
+  std::vector<bool> dirty;
+  QHash<fe_Object *, std::vector<size_t>> definitions;
   for (;;)
   {
-    auto *r = fe_read(ctx, read_fn, &it);
+    const auto *start = it;
+    auto *r = fe_readspan(m_fe, &it, end);
     if (!r)
       break;
-    last = fe_eval(ctx, r);
+    fe_pushgc(m_fe, r);
+    parsed.push_back(r);
+
+    TopLevelForm form;
+    form.text = QByteArray(start, int(it - start)).trimmed();
+    form.defines = defined_symbol(m_fe, r);
+    QSet<fe_Object *> symbols;
+    collect_symbols(m_fe, r, symbols);
+    form.uses.assign(symbols.begin(), symbols.end());
+    // a late require may rebind anything
+    incremental = incremental && !symbols.contains(require);
+
+    bool changed = true;
+    const auto match = unmatched.find(form.text);
+    if (match != unmatched.end())
+    {
+      auto &p = previous[match.value()];
+      form.value = p.value;
+      form.events = std::move(p.events);
+      unmatched.erase(match);
+      changed = false;
+      for (auto *s : form.uses)
+        changed = changed || !bindings.contains(s) || bindings.value(s) != fe_eval(m_fe, s);
+    }
+    if (form.defines)
+      definitions[form.defines].push_back(m_forms.size());
+    dirty.push_back(changed);
+    m_forms.push_back(std::move(form));
+  }
+
+  // a removed definition takes its binding along, unless the symbol was
+  // bound again since, e.g. by the prelude
+  QSet<fe_Object *> unbound;
+  for (auto i : qAsConst(unmatched))
+  {
+    auto *s = previous[i].defines;
+    if (s && !definitions.contains(s) && bindings.contains(s) && bindings.value(s) == fe_eval(m_fe, s))
+    {
+      fe_set(m_fe, s, fe_bool(m_fe, false));
+      unbound.insert(s);
+    }
+  }
+  for (size_t i = 0; i < m_forms.size(); ++i)
+    for (auto *s : m_forms[i].uses)
+      if (unbound.contains(s))
+        dirty[i] = true;
+
+  if (!incremental)
+    dirty.assign(dirty.size(), true);
+  for (bool again = true; again;)
+  {
+    again = false;
+    for (size_t i = 0; i < m_forms.size(); ++i)
+      for (auto *s : m_forms[i].uses)
+      {
+        const auto d = definitions.constFind(s);
+        if (dirty[i] || d == definitions.constEnd())
+          continue;
+        for (auto j : *d)
+          if (dirty[j])
+          {
+            dirty[i] = true;
+            again = true;
+            break;
+          }
+      }
+  }
+
+  fe_Object *last{nullptr};
+  int gc = fe_savegc(m_fe);
+  fe_handlers(m_fe)->write = on_write;
+  try
+  {
+    for (size_t i = 0; i < m_forms.size(); ++i)
+    {
+      auto &form = m_forms[i];
+      if (dirty[i])
+      {
+        form.events.clear();
+        form.sideEffects = false;
+        m_scene.events = &form.events;
+        m_evaluating = &form;
+        form.value = fe_eval(m_fe, parsed[i]);
+        m_evaluating = nullptr;
+        m_scene.events = nullptr;
+        if (form.sideEffects)
+          std::fill(dirty.begin() + long(i) + 1, dirty.end(), true);
+      }
+      else
+      {
+        for (const auto &e : form.events)
+          e(*m_scene.target);
+      }
+      last = form.value;
+
+      fe_restoregc(m_fe, gc);
+      fe_pushgc(m_fe, last);
+    }
+  }
+  catch (...)
+  {
+    // a failed eval leaves no state to compare against, the next one is complete
+    m_scene.events = nullptr;
+    m_evaluating = nullptr;
+    fe_handlers(m_fe)->write = nullptr;
+    m_forms.clear();
+    throw;
+  }
+  fe_handlers(m_fe)->write = nullptr;
+
+  for (const auto &form : m_forms)
+    for (auto *s : form.uses)
+      m_bindings.insert(s, fe_eval(m_fe, s));
+  rootForms();
+  return last;
+}
+
+void FeWrap::rootForms()
+{
+  // compared values must not be collected and their address reused
+  int gc = fe_savegc(m_fe);
+  auto *l = fe_bool(m_fe, false);
+  for (const auto &form : m_forms)
+  {
+    if (form.value)
+      l = fe_cons(m_fe, form.value, l);
+    fe_restoregc(m_fe, gc);
+    fe_pushgc(m_fe, l);
+  }
+  for (auto *v : qAsConst(m_bindings))
+  {
+    l = fe_cons(m_fe, v, l);
+    fe_restoregc(m_fe, gc);
+    fe_pushgc(m_fe, l);
+  }
+  setRoot(m_formsRoot, l);
+  fe_restoregc(m_fe, gc);
+}
+
+void FeWrap::Recorder::add_animation(const QString &name, float l, const vec3 &lp, RenderObjectPtr o)
+{
+  if (!target)
+    return;
+  ++changes;
+  if (events)
+    events->push_back([name, l, lp, o](SceneHandler &s) { s.add_animation(name, l, lp, o); });
+  target->add_animation(name, l, lp, std::move(o));
+}
+
+void FeWrap::Recorder::on_tick(const Ticker &tick)
+{
+  if (!target)
+    return;
+  ++changes;
+  if (events)
+    events->push_back([tick](SceneHandler &s) { s.on_tick(tick); });
+  target->on_tick(tick);
+}
+
+static fe_Object *copy_form(fe_Context *ctx, fe_Object *o)
+{
+  if (fe_type(ctx, o) != FE_TPAIR)
+    return o;
+
+  int gc = fe_savegc(ctx);
+  std::vector<fe_Object *> items;
+  for (; fe_type(ctx, o) == FE_TPAIR; o = fe_cdr(ctx, o))
+  {
+    items.push_back(copy_form(ctx, fe_car(ctx, o)));
+    fe_pushgc(ctx, items.back());
+  }
+  for (auto it = items.rbegin(); it != items.rend(); ++it)
+    o = fe_cons(ctx, *it, o);
+
+  fe_restoregc(ctx, gc);
+  fe_pushgc(ctx, o);
+  return o;
+}
+
+fe_Object *FeWrap::_evalForms(fe_Context *ctx, fe_Object *forms)
+{
+  // macro expansion rewrites the forms it runs, so cached ones are evaluated as copies
+  fe_Object *last{nullptr};
+  fe_pushgc(ctx, forms);
+  int gc = fe_savegc(ctx);
+  while (!fe_isnil(ctx, forms))
+  {
+    last = fe_eval(ctx, copy_form(ctx, fe_nextarg(ctx, &forms)));
 
     fe_restoregc(ctx, gc);
     fe_pushgc(ctx, last);
@@ -624,7 +1748,7 @@ fe_Object *FeWrap::_require(fe_Context *ctx, fe_Object *arg)
   while (!fe_isnil(ctx, arg))
   {
     const auto f = from_string(ctx, fe_nextarg(ctx, &arg)).replace(".", QDir::separator()).append(".fe");
-    last = _eval(ctx, _self(ctx)->codeOf(f));
+    last = _evalForms(ctx, _self(ctx)->moduleForms(f));
 
     fe_restoregc(ctx, gc);
     fe_pushgc(ctx, last);
@@ -638,68 +1762,108 @@ fe_Object *FeWrap::_require(fe_Context *ctx, fe_Object *arg)
   while (!fe_isnil(ctx, cl))
     x += "\n=> " + from_string(ctx, fe_nextarg(ctx, &cl));
 
+  auto *b = fe_budget(ctx);
+  const auto timeout = fe_cancelled(ctx) || b->steps == 0 || (b->poll && b->poll(ctx));
+  _self(ctx)->endEval();
+
   fe_restoregc(ctx, _self(ctx)->m_evalStackBackup);
+  if (timeout)
+    throw Timeout(x.toLocal8Bit());
   throw std::runtime_error(x.toLocal8Bit());
 }
 
+fe_Object *FeWrap::on_write(fe_Context *ctx, fe_Object *o)
+{
+  auto *form = _self(ctx)->m_evaluating;
+  if (form && o != form->defines)
+    form->sideEffects = true;
+  return nullptr;
+}
+
+int FeWrap::_expired(fe_Context *ctx)
+{
+  return _self(ctx)->m_deadline.hasExpired();
+}
+
 static fe_Object *on_gc(fe_Context *ctx, fe_Object *o)
 {
-  delete reinterpret_cast<CustomPtr *>(fe_toptr(ctx, o));
+  pool().release(reinterpret_cast<CustomPtr *>(fe_toptr(ctx, o)));
   return nullptr;
 }
 
+static void set_native(fe_Context *ctx, const char *name, fe_CFunc f, FeExpr::Op op)
+{
+  FeExpr::define(f, op);
+  fe_set(ctx, fe_symbol(ctx, name), fe_cfunc(ctx, f));
+}
+
 void FeWrap::init_fn(fe_Context *ctx)
 {
   auto *h = fe_handlers(ctx);
   h->error = on_error;
   h->gc = on_gc;
 
-  fe_set(ctx, fe_symbol(ctx, "%"), fe_cfunc(ctx, _mod));
-  fe_set(ctx, fe_symbol(ctx, "max"), fe_cfunc(ctx, _max));
-  fe_set(ctx, fe_symbol(ctx, "min"), fe_cfunc(ctx, _min));
+  set_native(ctx, "%", _mod, FeExpr::Mod);
+  set_native(ctx, "max", _max, FeExpr::Max);
+  set_native(ctx, "min", _min, FeExpr::Min);
   fe_set(ctx, fe_symbol(ctx, "pi"), fe_number(ctx, M_PI));
-  fe_set(ctx, fe_symbol(ctx, "rad"), fe_cfunc(ctx, [](fe_Context *ctx, fe_Object *arg) {
-           const auto n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
-           return fe_number(ctx, M_PI * (n / 180.0));
-         }));
-  fe_set(ctx, fe_symbol(ctx, "deg"), fe_cfunc(ctx, [](fe_Context *ctx, fe_Object *arg) {
-           const auto n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
-           return fe_number(ctx, 180.0 * (n / M_PI));
-         }));
-  fe_set(ctx, fe_symbol(ctx, "fsin"), fe_cfunc(ctx, [](fe_Context *ctx, fe_Object *arg) {
-           const auto n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
-           auto f = 1.0;
-           if (!fe_isnil(ctx, arg))
-             f = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
-           return fe_number(ctx, sin(f * 2.0 * n * M_PI));
-         }));
-  fe_set(ctx, fe_symbol(ctx, "fcos"), fe_cfunc(ctx, [](fe_Context *ctx, fe_Object *arg) {
-           const auto n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
-           auto f = 1.0;
-           if (!fe_isnil(ctx, arg))
-             f = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
-           return fe_number(ctx, cos(f * 2.0 * n * M_PI));
-         }));
-
-#define _func(f)                                                                                                       \
-  fe_set(ctx, fe_symbol(ctx, #f), fe_cfunc(ctx, [](fe_Context *ctx, fe_Object *arg) {                                  \
-           const auto n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));                                                     \
-           return fe_number(ctx, f(n));                                                                                \
-         }))
-  _func(floor);
-  _func(ceil);
-  _func(abs);
-  _func(sqrt);
-  _func(sin);
-  _func(cos);
-  _func(tan);
-  _func(acos);
-  _func(atan);
-  _func(atan);
+  set_native(
+    ctx, "rad",
+    [](fe_Context *ctx, fe_Object *arg) {
+      const auto n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+      return fe_number(ctx, M_PI * (n / 180.0));
+    },
+    FeExpr::Rad);
+  set_native(
+    ctx, "deg",
+    [](fe_Context *ctx, fe_Object *arg) {
+      const auto n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+      return fe_number(ctx, 180.0 * (n / M_PI));
+    },
+    FeExpr::Deg);
+  set_native(
+    ctx, "fsin",
+    [](fe_Context *ctx, fe_Object *arg) {
+      const auto n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+      auto f = 1.0;
+      if (!fe_isnil(ctx, arg))
+        f = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+      return fe_number(ctx, sin(f * 2.0 * n * M_PI));
+    },
+    FeExpr::FSin);
+  set_native(
+    ctx, "fcos",
+    [](fe_Context *ctx, fe_Object *arg) {
+      const auto n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+      auto f = 1.0;
+      if (!fe_isnil(ctx, arg))
+        f = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+      return fe_number(ctx, cos(f * 2.0 * n * M_PI));
+    },
+    FeExpr::FCos);
+
+#define _func(f, op)                                                                                                   \
+  set_native(                                                                                                          \
+    ctx, #f,                                                                                                           \
+    [](fe_Context *ctx, fe_Object *arg) {                                                                              \
+      const auto n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));                                                          \
+      return fe_number(ctx, std::f(n));                                                                                \
+    },                                                                                                                 \
+    FeExpr::op)
+  _func(floor, Floor);
+  _func(ceil, Ceil);
+  _func(abs, Abs);
+  _func(sqrt, Sqrt);
+  _func(sin, Sin);
+  _func(cos, Cos);
+  _func(tan, Tan);
+  _func(acos, ACos);
+  _func(atan, ATan);
+  _func(atan, ATan);
 
   fe_set(ctx, fe_symbol(ctx, "self"), custom(ctx, this));
 
-  fe_set(ctx, fe_symbol(ctx, "vec3"), fe_cfunc(ctx, _vec3));
+  set_native(ctx, "vec3", _vec3, FeExpr::Vec3);
   fe_set(ctx, fe_symbol(ctx, "color"), fe_cfunc(ctx, _color));
 
   fe_set(ctx, fe_symbol(ctx, "cube"), fe_cfunc(ctx, _cube));
@@ -708,6 +1872,23 @@ void FeWrap::init_fn(fe_Context *ctx)
   fe_set(ctx, fe_symbol(ctx, "helper"), fe_cfunc(ctx, _helper));
 
   fe_set(ctx, fe_symbol(ctx, "lfo"), fe_cfunc(ctx, _lfo));
+  fe_set(ctx, fe_symbol(ctx, "keys"), fe_cfunc(ctx, _keys));
+  fe_set(ctx, fe_symbol(ctx, "ease-in"), fe_cfunc(ctx, _easeIn));
+  fe_set(ctx, fe_symbol(ctx, "ease-out"), fe_cfunc(ctx, _easeOut));
+  fe_set(ctx, fe_symbol(ctx, "ease-in-out"), fe_cfunc(ctx, _easeInOut));
+  fe_set(ctx, fe_symbol(ctx, "bezier"), fe_cfunc(ctx, _bezier));
+  fe_set(ctx, fe_symbol(ctx, "spline"), fe_cfunc(ctx, _spline));
+  fe_set(ctx, fe_symbol(ctx, "step"), fe_cfunc(ctx, _step));
+  fe_set(ctx, fe_symbol(ctx, "pingpong"), fe_cfunc(ctx, _pingpong));
+
+  fe_set(ctx, fe_symbol(ctx, "vec+"), fe_cfunc(ctx, _vadd));
+  fe_set(ctx, fe_symbol(ctx, "vec-"), fe_cfunc(ctx, _vsub));
+  fe_set(ctx, fe_symbol(ctx, "vec*"), fe_cfunc(ctx, _vmul));
+  fe_set(ctx, fe_symbol(ctx, "dot"), fe_cfunc(ctx, _dot));
+  fe_set(ctx, fe_symbol(ctx, "cross"), fe_cfunc(ctx, _cross));
+  fe_set(ctx, fe_symbol(ctx, "lerp"), fe_cfunc(ctx, _lerp));
+  fe_set(ctx, fe_symbol(ctx, "length"), fe_cfunc(ctx, _length));
+  fe_set(ctx, fe_symbol(ctx, "normalize"), fe_cfunc(ctx, _normalize));
 
   fe_set(ctx, fe_symbol(ctx, "translate"), fe_cfunc(ctx, _translate));
   fe_set(ctx, fe_symbol(ctx, "rotate"), fe_cfunc(ctx, _rotate));
@@ -1,26 +1,41 @@
 #ifndef FEWRAP_H
 #define FEWRAP_H
 
+#include <QByteArray>
+#include <QDeadlineTimer>
 #include <QHash>
+#include <QMutex>
 #include <QString>
 #include <functional>
 #include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "SceneHandler.h"
 
 typedef struct fe_Object fe_Object;
 typedef struct fe_Context fe_Context;
 
 class RenderObject;
 class RenderContainer;
-class SceneHandler;
 
 class FeWrap
 {
 public:
-  explicit FeWrap(SceneHandler &s);
+  FeWrap();
   ~FeWrap();
 
   QString newSession(const QString &f);
-  QString eval();
+  // thrown by eval when it ran out of time or steps or was cancelled
+  class Timeout : public std::runtime_error
+  {
+  public:
+    using std::runtime_error::runtime_error;
+  };
+  // msecs and steps limit the eval, 0 and -1 for no limit
+  QString eval(SceneHandler &s, int msecs = 0, long steps = -1);
+  // stops the running eval from any thread, a cancel before it started is dropped
+  void cancel();
 
   bool codeExists(const QString &f) const;
   QString codeOf(const QString &f);
@@ -38,6 +53,10 @@ public:
 
   SceneHandler *scene() { return &m_scene; }
 
+  // Guards the fe context, so eval may run on another thread. Tickers
+  // calling fe code skip a frame while it is taken.
+  QMutex &mutex() { return m_mutex; }
+
 private:
   static fe_Object *_mod(fe_Context *ctx, fe_Object *arg);
 
@@ -63,25 +82,116 @@ private:
   static fe_Object *_animation(fe_Context *ctx, fe_Object *arg);
 
   static fe_Object *_lfo(fe_Context *ctx, fe_Object *arg);
-
-  static fe_Object *_eval(fe_Context *ctx, const QString &);
+  static fe_Object *_keys(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_easeIn(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_easeOut(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_easeInOut(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_bezier(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_spline(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_step(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_pingpong(fe_Context *ctx, fe_Object *arg);
+
+  static fe_Object *_vadd(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_vsub(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_vmul(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_dot(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_cross(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_lerp(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_length(fe_Context *ctx, fe_Object *arg);
+  static fe_Object *_normalize(fe_Context *ctx, fe_Object *arg);
+
+  static fe_Object *_evalForms(fe_Context *ctx, fe_Object *forms);
   static fe_Object *_require(fe_Context *ctx, fe_Object *arg);
   [[noreturn]] static void on_error(fe_Context *ctx, const char *err, fe_Object *cl);
+  static fe_Object *on_write(fe_Context *ctx, fe_Object *o);
+  static int _expired(fe_Context *ctx);
 
   void init_fn(fe_Context *ctx);
 
+  bool cachedCode(const QString &f, QString &code);
+  QString loadCode(const QString &f);
+  fe_Object *moduleForms(const QString &f);
+  void setRoot(int &root, fe_Object *o);
+  void rootModules();
+  fe_Object *evalPrelude(const char *&it, const char *end);
+  fe_Object *evalTopLevel(const char *it, const char *end);
+  void rootForms();
+  void endEval();
+
 private:
   static const int m_size{1024 * 100};
+  static const int m_segmentSize{1024 * 4};
+  static const int m_heapGrowth{50};
+  static const int m_nurserySize{1024 * 2};
   void *m_data{nullptr};
   fe_Context *m_fe{nullptr};
-
-  SceneHandler &m_scene;
+  // reads definitions for the gui while an eval owns m_fe
+  static const int m_readerSize{1024 * 16};
+  void *m_readerData{nullptr};
+  fe_Context *m_reader{nullptr};
+
+  using SceneEvent = std::function<void(SceneHandler &)>;
+
+  // forwards to the scene and keeps what the current top level form adds,
+  // fe code called outside of an eval has no scene to add to
+  class Recorder : public SceneHandler
+  {
+  public:
+    void add_animation(const QString &name, float l, const slm::vec3 &lp, RenderObjectPtr o) final;
+    void on_tick(const Ticker &tick) final;
+
+    SceneHandler *target{nullptr};
+    std::vector<SceneEvent> *events{nullptr};
+    int changes{0};
+  };
+  Recorder m_scene;
 
   QString m_mainFile;
+  // taken only briefly, so the gui never waits for an eval
+  mutable QMutex m_filesLock;
   QHash<QString, QString> m_fileContents;
+
+  struct ParsedModule
+  {
+    uint hash;
+    fe_Object *forms;
+  };
+  QHash<QString, ParsedModule> m_modules;
+  int m_modulesRoot{-1};
+  QHash<QString, uint> m_required;
+
+  struct Snapshot
+  {
+    QByteArray prelude;
+    QHash<QString, uint> modules;
+    fe_Object *bindings{nullptr};
+    fe_Object *last{nullptr};
+  };
+  Snapshot m_snapshot;
+  int m_snapshotRoot{-1};
+
+  struct TopLevelForm
+  {
+    QByteArray text;
+    fe_Object *defines{nullptr};
+    std::vector<fe_Object *> uses;
+    fe_Object *value{nullptr};
+    std::vector<SceneEvent> events;
+    // wrote another global than the defined one or changed a pair
+    bool sideEffects{false};
+  };
+  std::vector<TopLevelForm> m_forms;
+  TopLevelForm *m_evaluating{nullptr};
+  QHash<fe_Object *, fe_Object *> m_bindings;
+  int m_formsRoot{-1};
   bool m_hasChanges{false};
 
   int m_evalStackBackup{0};
+  QDeadlineTimer m_deadline;
+  mutable QMutex m_mutex;
+  // orders cancel against the start and end of an eval
+  QMutex m_cancelLock;
+  bool m_running{false};
 };
 
 #endif // FEWRAP_H
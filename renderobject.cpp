@@ -31,6 +31,12 @@ void RenderContainer::draw(QOpenGLShaderProgram &p, const QMatrix4x4 &t, bool he
     ro->draw(p, t, helper);
 }
 
+void RenderContainer::params(std::vector<float *> &p) const
+{
+  for (const auto &ro : m_children)
+    ro->params(p);
+}
+
 void HelperContainer::draw(QOpenGLShaderProgram &p, const QMatrix4x4 &t, bool helper)
 {
   if (helper)
@@ -44,6 +50,12 @@ void ScaleContainer::draw(QOpenGLShaderProgram &p, const QMatrix4x4 &t, bool hel
   RenderContainer::draw(p, s, helper);
 }
 
+void ScaleContainer::params(std::vector<float *> &p) const
+{
+  p.insert(p.end(), {m_scale[0].get(), m_scale[1].get(), m_scale[2].get()});
+  RenderContainer::params(p);
+}
+
 void TranslateContainer::draw(QOpenGLShaderProgram &p, const QMatrix4x4 &t, bool helper)
 {
   QMatrix4x4 s = t;
@@ -51,9 +63,21 @@ void TranslateContainer::draw(QOpenGLShaderProgram &p, const QMatrix4x4 &t, bool
   RenderContainer::draw(p, s, helper);
 }
 
+void TranslateContainer::params(std::vector<float *> &p) const
+{
+  p.insert(p.end(), {m_translate[0].get(), m_translate[1].get(), m_translate[2].get()});
+  RenderContainer::params(p);
+}
+
 void RotateContainer::draw(QOpenGLShaderProgram &p, const QMatrix4x4 &t, bool helper)
 {
   QMatrix4x4 s = t;
   s.rotate(*m_angle, *m_axis[0], *m_axis[1], *m_axis[2]);
   RenderContainer::draw(p, s, helper);
 }
+
+void RotateContainer::params(std::vector<float *> &p) const
+{
+  p.insert(p.end(), {m_angle.get(), m_axis[0].get(), m_axis[1].get(), m_axis[2].get()});
+  RenderContainer::params(p);
+}
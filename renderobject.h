@@ -25,6 +25,8 @@ public:
   virtual ~RenderObject() = default;
 
   virtual void draw(QOpenGLShaderProgram &, const QMatrix4x4 &, bool) = 0;
+  // the animated values drawing reads
+  virtual void params(std::vector<float *> &) const {}
 
   static PrimitiveProvider *primitives;
 };
@@ -53,6 +55,7 @@ public:
   void add(RenderObjectPtr ro);
 
   void draw(QOpenGLShaderProgram &, const QMatrix4x4 &, bool) override;
+  void params(std::vector<float *> &p) const override;
 
 private:
   std::vector<RenderObjectPtr> m_children;
@@ -81,6 +84,7 @@ public:
   void set_scale(const slm::vec3 &s) { set_scale(shared(s)); }
 
   void draw(QOpenGLShaderProgram &p, const QMatrix4x4 &t, bool) final;
+  void params(std::vector<float *> &p) const final;
 
 private:
   s_vec3 m_scale{shared(slm::vec3(1.0))};
@@ -101,6 +105,7 @@ public:
   void set_translate(const slm::vec3 &t) { set_translate(shared(t)); }
 
   void draw(QOpenGLShaderProgram &p, const QMatrix4x4 &t, bool) final;
+  void params(std::vector<float *> &p) const final;
 
 private:
   s_vec3 m_translate{shared(slm::vec3(1.0))};
@@ -129,6 +134,7 @@ public:
   void set_rotate(s_float a, const slm::vec3 &ax) { set_rotate(a, shared(ax)); }
 
   void draw(QOpenGLShaderProgram &p, const QMatrix4x4 &t, bool) final;
+  void params(std::vector<float *> &p) const final;
 
 private:
   s_float m_angle{shared(0.0f)};
@@ -0,0 +1,39 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "SceneHandler.h"
+#include "slm/vec3.h"
+
+#include <QString>
+#include <vector>
+
+// everything one evaluation added, shown by View3D as a whole
+class Scene : public SceneHandler
+{
+public:
+  struct Animation
+  {
+    QString name;
+    float length{0.5};
+    slm::vec3 light_pos{0.0, -2.0, 8.0};
+    RenderObjectPtr scene;
+
+    Animation(const QString &n, float l, const slm::vec3 &lp, RenderObjectPtr s)
+      : name{n}
+      , length{l}
+      , light_pos{lp}
+      , scene{std::move(s)}
+    {}
+  };
+
+  void add_animation(const QString &name, float l, const slm::vec3 &lp, RenderObjectPtr o) final
+  {
+    animations.emplace_back(name, l, lp, std::move(o));
+  }
+  void on_tick(const Ticker &tick) final { ticker.emplace_back(tick); }
+
+  std::vector<Animation> animations;
+  std::vector<Ticker> ticker;
+};
+
+#endif // SCENE_H
@@ -11,7 +11,10 @@
 #include <QOpenGLFramebufferObject>
 #include <QPainter>
 #include <QShortcut>
+#include <algorithm>
+#include <cmath>
 #include <ranges>
+#include <unordered_set>
 
 View3D::View3D(QWidget *parent)
   : QOpenGLWidget(parent)
@@ -22,14 +25,105 @@ View3D::View3D(QWidget *parent)
   RenderObject::primitives = this;
 }
 
-View3D::~View3D() = default;
+View3D::~View3D()
+{
+  makeCurrent();
+  setScene(Scene());
+  deleteReleased();
+  {
+    // without a view there is no context to wait for
+    QMutexLocker lock(&m_released->lock);
+    m_released->closed = true;
+  }
+  doneCurrent();
+}
+
+// the tickers values depend on, walking back through the ones writing them
+static std::vector<const Ticker *> dependencies(const std::vector<Ticker> &ticker, const std::vector<float *> &values)
+{
+  std::unordered_set<const float *> needed(values.begin(), values.end());
+  std::vector<const Ticker *> r;
+  for (auto i = ticker.size(); i > 0; --i)
+  {
+    const auto &t = ticker[i - 1];
+    if (std::none_of(t.writes.begin(), t.writes.end(), [&](auto *p) { return needed.count(p) > 0; }))
+      continue;
+    r.push_back(&t);
+    needed.insert(t.reads.begin(), t.reads.end());
+  }
+  std::reverse(r.begin(), r.end());
+  return r;
+}
+
+// The written values that repeat every length without jumps, so sampling
+// them over length and interpolating between the samples loses nothing
+// but detail. Values no ticker writes are constant.
+static std::unordered_set<const float *> bakeable(const std::vector<const Ticker *> &ticker, float length)
+{
+  std::unordered_set<const float *> written, r;
+  for (const auto *t : ticker)
+    written.insert(t->writes.begin(), t->writes.end());
+  for (const auto *t : ticker)
+  {
+    auto ok = false;
+    if (t->period > 0.0f)
+    {
+      const auto n = length / t->period;
+      ok = n > 0.5f && std::abs(n - std::round(n)) < 1e-3f;
+    }
+    else if (t->period < 0.0f)
+    {
+      ok = std::all_of(t->reads.begin(), t->reads.end(),
+                       [&](auto *p) { return written.count(p) == 0 || r.count(p) > 0; });
+    }
+    if (ok)
+      r.insert(t->writes.begin(), t->writes.end());
+    else
+      for (auto *p : t->writes)
+        r.erase(p);
+  }
+  return r;
+}
 
 void View3D::showAnimation(const QString &name)
 {
   m_animation = nullptr;
-  for (const auto &a : m_animations)
+  m_all.clear();
+  m_live.clear();
+  m_baked.clear();
+  for (const auto &a : m_scene.animations)
     if (a.name == name)
       m_animation = &a;
+  if (!m_animation)
+    return;
+
+  std::vector<float *> drawn;
+  m_animation->scene->params(drawn);
+  const auto all = dependencies(m_scene.ticker, drawn);
+  for (const auto *t : all)
+    m_all.add(t);
+
+  // only drawn values some ticker writes change over time, the periodic ones
+  // are baked and the others tick live
+  std::unordered_set<const float *> written;
+  for (const auto *t : all)
+    written.insert(t->writes.begin(), t->writes.end());
+  const auto periodic = m_bakeRate > 0.0f ? bakeable(all, m_animation->length) : decltype(written){};
+  std::vector<float *> baked, live;
+  for (auto *p : drawn)
+    if (written.erase(p) > 0)
+      (periodic.count(p) > 0 ? baked : live).push_back(p);
+
+  m_baked.bake(baked, m_animation->length, m_bakeRate, m_bakeLimit, [this](float t) { m_all.run(t); });
+  for (const auto *t : m_baked.empty() ? all : dependencies(m_scene.ticker, live))
+    m_live.add(t);
+}
+
+void View3D::setBakeRate(float rate)
+{
+  m_bakeRate = rate;
+  if (m_animation)
+    showAnimation(QString(m_animation->name));
 }
 
 void View3D::toggleHelper()
@@ -61,6 +155,8 @@ void View3D::initializeGL()
 
 void View3D::paintGL()
 {
+  deleteReleased();
+
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
   m_program.bind();
@@ -118,15 +214,37 @@ slm::vec3 View3D::mouseInSpace(const QPoint &mp)
 
 SharedDisplayObject View3D::loadObject(const QString &path)
 {
+  // scenes are built on the evaluation thread
+  QMutexLocker lock(&m_displayLock);
   auto res = m_displayObjects.value(path).lock();
   if (!res)
   {
-    res = std::make_shared<DisplayObject>(path);
+    res = SharedDisplayObject(new DisplayObject(path), [released = m_released](DisplayObject *o) {
+      QMutexLocker lock(&released->lock);
+      if (released->closed)
+      {
+        lock.unlock();
+        delete o;
+      }
+      else
+        released->objects.push_back(o);
+    });
     m_displayObjects.insert(path, res);
   }
   return res;
 }
 
+void View3D::deleteReleased()
+{
+  std::vector<DisplayObject *> objects;
+  {
+    QMutexLocker lock(&m_released->lock);
+    objects.swap(m_released->objects);
+  }
+  for (auto *o : objects)
+    delete o;
+}
+
 SharedDisplayObject View3D::cube()
 {
   const auto d = QFileInfo(QApplication::applicationFilePath()).absoluteDir();
@@ -135,24 +253,16 @@ SharedDisplayObject View3D::cube()
   return loadObject(d.filePath("../assets/cube.ply"));
 }
 
-void View3D::clear_scene()
+void View3D::setScene(Scene &&s)
 {
   m_animation = nullptr;
-  m_animations.clear();
-  m_ticker.clear();
+  m_all.clear();
+  m_live.clear();
+  m_baked.clear();
+  m_scene = std::move(s);
   m_timer.restart();
 }
 
-void View3D::add_animation(const QString &name, float l, const slm::vec3 &lp, RenderObjectPtr o)
-{
-  m_animations.emplace_back(name, l, lp, std::move(o));
-}
-
-void View3D::on_tick(const Tick &tick)
-{
-  m_ticker.emplace_back(tick);
-}
-
 void View3D::mousePressEvent(QMouseEvent *) {}
 
 void View3D::mouseReleaseEvent(QMouseEvent *) {}
@@ -195,8 +305,7 @@ void View3D::timerEvent(QTimerEvent *te)
   }
   m_cam.tick();
 
-  for (const auto &t : m_ticker)
-    t(double(m_timer.elapsed()) / 1000.0);
+  tick(double(m_timer.elapsed()) / 1000.0);
 
   applyCursor();
   update();
@@ -204,6 +313,34 @@ void View3D::timerEvent(QTimerEvent *te)
   QOpenGLWidget::timerEvent(te);
 }
 
+void View3D::tick(double t)
+{
+  m_baked.apply(float(t));
+  m_live.run(float(t));
+}
+
+void View3D::Tickers::clear()
+{
+  ticker.clear();
+  waves.clear();
+}
+
+void View3D::Tickers::add(const Ticker *t)
+{
+  // waves read nothing, so they can all go first in one batch
+  if (t->wave)
+    waves.add(*t->wave);
+  else
+    ticker.push_back(t);
+}
+
+void View3D::Tickers::run(float t)
+{
+  waves.tick(t);
+  for (const auto *x : ticker)
+    x->tick(t);
+}
+
 void View3D::drawObjects()
 {
   if (m_animation)
@@ -280,8 +417,8 @@ void View3D::applyCursor()
 
 QImage View3D::toImage(double t, int w, int h)
 {
-  for (const auto &ticker : m_ticker)
-    ticker(t);
+  // exported frames are exact, not taken from the baked samples
+  m_all.run(float(t));
 
   QOpenGLContext context;
   context.setShareContext(this->context());
@@ -342,7 +479,7 @@ QVector<QPixmap> View3D::allFrames(int w, int h)
 QStringList View3D::animations() const
 {
   QStringList names;
-  for (const auto &a : m_animations)
+  for (const auto &a : m_scene.animations)
     names.append(a.name);
   return names;
 }
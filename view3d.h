@@ -1,12 +1,15 @@
 #ifndef VIEW3D_H
 #define VIEW3D_H
 
-#include "SceneHandler.h"
+#include "bakedanimation.h"
 #include "camera.h"
 #include "displayobject.h"
 #include "renderobject.h"
+#include "scene.h"
+#include "wavetable.h"
 
 #include <QElapsedTimer>
+#include <QMutex>
 #include <QOpenGLFunctions>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLWidget>
@@ -19,7 +22,6 @@ class Ray;
 class View3D
   : public QOpenGLWidget
   , public PrimitiveProvider
-  , public SceneHandler
   , protected QOpenGLFunctions
 {
 public:
@@ -34,9 +36,10 @@ public:
   SharedDisplayObject loadObject(const QString &path);
   SharedDisplayObject cube() final;
 
-  void clear_scene();
-  void add_animation(const QString &name, float l, const slm::vec3 &lp, RenderObjectPtr) final;
-  void on_tick(const Tick &) final;
+  void setScene(Scene &&s);
+  // samples per second the periodic values of a shown animation are baked
+  // with, 0 to tick everything live
+  void setBakeRate(float rate);
 
   QImage toImage(double t, int w, int h);
   QVector<QPixmap> allFrames(int w, int h);
@@ -59,10 +62,12 @@ protected:
   void timerEvent(QTimerEvent *te) final;
 
 private: // helper
+  void tick(double t);
   void drawObjects();
   void drawLine(const QColor &c, const std::vector<slm::vec3> &l);
 
   void initShaders();
+  void deleteReleased();
 
   slm::vec3 unProject(const QPoint &mousePos, float winz) const;
   Ray calcPickRay(const QPoint &mousePos) const;
@@ -79,27 +84,39 @@ private: // data
 
   QOpenGLShaderProgram m_program;
 
+  QMutex m_displayLock;
   QHash<QString, WeakDisplayObject> m_displayObjects;
+  // Display objects may lose their last reference on the evaluation thread,
+  // their buffers are freed on the next paint with the context current.
+  struct Released
+  {
+    QMutex lock;
+    std::vector<DisplayObject *> objects;
+    bool closed{false};
+  };
+  std::shared_ptr<Released> m_released{std::make_shared<Released>()};
 
-  struct Animation
+  Scene m_scene;
+  const Scene::Animation *m_animation{nullptr};
+
+  // tickers in the order they were added, the waves among them run first
+  struct Tickers
   {
-    QString name;
-    float length{0.5};
-    slm::vec3 light_pos{0.0, -2.0, 8.0};
-    RenderObjectPtr scene;
-
-    Animation(const QString &n, float l, const slm::vec3 &lp, RenderObjectPtr s)
-      : name{n}
-      , length{l}
-      , light_pos{lp}
-      , scene{std::move(s)}
-    {}
+    std::vector<const Ticker *> ticker;
+    WaveTable waves;
+
+    void clear();
+    void add(const Ticker *t);
+    void run(float t);
   };
-  const Animation *m_animation{nullptr};
-  std::vector<Animation> m_animations;
+  // all tickers m_animation depends on, and those the baked values leave
+  Tickers m_all;
+  Tickers m_live;
+  BakedAnimation m_baked;
+  float m_bakeRate{60.0f};
+  static const int m_bakeLimit{1024 * 1024 * 4};
 
   QElapsedTimer m_timer;
-  std::vector<Tick> m_ticker;
 };
 
 #endif // VIEW3D_H
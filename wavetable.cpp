@@ -0,0 +1,51 @@
+#include "wavetable.h"
+
+#include <cmath>
+
+// sin(2 pi t f) without branches or calls so the loop using it vectorizes.
+// The phase is reduced in double like std::sin did, adding 1.5 * 2^52
+// rounds it to an integer. The series to u^11 on [-pi/2, pi/2] stays within
+// 2.1e-7 of sin for the reduced phase, about the float rounding of the result.
+static inline float sin_turns(float t, float f)
+{
+  const auto x = double(t) * double(f);
+  auto z = float(x - ((x + 6755399441055744.0) - 6755399441055744.0));
+  // sin(pi - a) = sin(a) folds [-0.5, 0.5] to [-0.25, 0.25]
+  z = std::copysign(0.25f - std::abs(std::abs(z) - 0.25f), z);
+  const auto u = z * float(2.0 * M_PI);
+  const auto u2 = u * u;
+  const auto p = 1.0f / 362880.0f + u2 * (-1.0f / 39916800.0f);
+  return u * (1.0f + u2 * (-1.0f / 6.0f + u2 * (1.0f / 120.0f + u2 * (-1.0f / 5040.0f + u2 * p))));
+}
+
+void WaveTable::clear()
+{
+  m_center.clear();
+  m_amp.clear();
+  m_frequency.clear();
+  m_result.clear();
+  m_value.clear();
+}
+
+void WaveTable::add(const Ticker::Wave &w)
+{
+  m_center.push_back(w.center);
+  m_amp.push_back(w.amp);
+  m_frequency.push_back(w.frequency);
+  m_result.push_back(w.center);
+  m_value.push_back(w.value);
+}
+
+void WaveTable::tick(float t)
+{
+  const auto n = m_result.size();
+  const auto *c = m_center.data();
+  const auto *a = m_amp.data();
+  const auto *f = m_frequency.data();
+  auto *r = m_result.data();
+  for (size_t i = 0; i < n; ++i)
+    r[i] = c[i] + a[i] * sin_turns(t, f[i]);
+
+  for (size_t i = 0; i < n; ++i)
+    *m_value[i] = r[i];
+}
@@ -0,0 +1,26 @@
+#ifndef WAVETABLE_H
+#define WAVETABLE_H
+
+#include "SceneHandler.h"
+
+#include <vector>
+
+// The lfo tickers of an animation, evaluated together in one pass over flat
+// arrays the compiler can vectorize, then stored to their values.
+class WaveTable
+{
+public:
+  void clear();
+  void add(const Ticker::Wave &w);
+
+  void tick(float t);
+
+private:
+  std::vector<float> m_center;
+  std::vector<float> m_amp;
+  std::vector<float> m_frequency;
+  std::vector<float> m_result;
+  std::vector<float *> m_value;
+};
+
+#endif // WAVETABLE_H